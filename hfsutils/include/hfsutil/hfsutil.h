@@ -31,6 +31,10 @@ void hfsutil_perrorp(const char *);
 hfsvol *hfsutil_remount(mountent *, int);
 void hfsutil_unmount(hfsvol *, int *);
 
+int hfsutil_keep(int);
+int hfsutil_sync(void);
+int hfsutil_run(int, char *[], int *);
+
 void hfsutil_pinfo(hfsvolent *);
 char **hfsutil_glob(hfsvol *, int, char *[], int *, int *);
 char *hfsutil_getcwd(hfsvol *);
@@ -27,6 +27,12 @@
 /* Define if you want to enable diagnostic debugging support. */
 #undef DEBUG
 
+/* Define if you want to use io_uring for batched block I/O. */
+#undef ENABLE_IO_URING
+
+/* Define if read-only volumes may be used by several threads at once. */
+#undef ENABLE_THREADS
+
 @BOTTOM@
 
 /*****************************************************************************
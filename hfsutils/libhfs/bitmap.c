@@ -0,0 +1,291 @@
+/*
+ * libhfs - library for reading and writing Macintosh HFS volumes
+ * Copyright (C) 1996-1998 Robert Leslie
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * $Id$
+ */
+
+# ifdef HAVE_CONFIG_H
+#  include "config.h"
+# endif
+
+# include <string.h>
+
+# include "libhfs.h"
+# include "bitmap.h"
+
+/*
+ * Bitmaps are scanned a machine word at a time. Bit 0 is the most
+ * significant bit of byte 0, so bytes are assembled into words most
+ * significant first, and the first set bit of a word is found by
+ * counting its leading zeros.
+ */
+
+# define WORDSZ		((unsigned int) sizeof(unsigned long))
+# define WORDBITS	(8 * WORDSZ)
+# define ALLBITS	(~0UL)
+
+# if defined(__GNUC__)
+#  define CLZ(w)	__builtin_clzl(w)
+#  define CTZ(w)	__builtin_ctzl(w)
+#  define POPCOUNT(w)	__builtin_popcountl(w)
+# else
+#  define CLZ(w)	clz(w)
+#  define CTZ(w)	ctz(w)
+#  define POPCOUNT(w)	popcount(w)
+
+/*
+ * NAME:	clz()
+ * DESCRIPTION:	count the leading zero bits of a nonzero word
+ */
+static
+unsigned int clz(unsigned long w)
+{
+  unsigned int n = 0;
+
+  while (! (w & ~(ALLBITS >> 1)))
+    w <<= 1, ++n;
+
+  return n;
+}
+
+/*
+ * NAME:	ctz()
+ * DESCRIPTION:	count the trailing zero bits of a nonzero word
+ */
+static
+unsigned int ctz(unsigned long w)
+{
+  unsigned int n = 0;
+
+  while (! (w & 1))
+    w >>= 1, ++n;
+
+  return n;
+}
+
+/*
+ * NAME:	popcount()
+ * DESCRIPTION:	count the set bits of a word
+ */
+static
+unsigned int popcount(unsigned long w)
+{
+  unsigned int n = 0;
+
+  for ( ; w; w &= w - 1)
+    ++n;
+
+  return n;
+}
+# endif
+
+/*
+ * NAME:	loadword()
+ * DESCRIPTION:	assemble up to a word of bitmap bytes, zero-filled on the right
+ */
+static
+unsigned long loadword(const byte *ptr, unsigned int len)
+{
+  unsigned long w = 0;
+  unsigned int i;
+
+  if (len >= WORDSZ)
+    {
+      for (i = 0; i < WORDSZ; ++i)
+	w = (w << 8) | ptr[i];
+    }
+  else
+    {
+      for (i = 0; i < len; ++i)
+	w = (w << 8) | ptr[i];
+
+      w <<= 8 * (WORDSZ - len);
+    }
+
+  return w;
+}
+
+/*
+ * NAME:	findbit()
+ * DESCRIPTION:	return the first bit in [pt, end) differing from flip, or end
+ */
+static
+unsigned int findbit(const byte *bm, unsigned int pt, unsigned int end,
+		     unsigned long flip)
+{
+  unsigned int nbytes, i, base;
+  unsigned long w;
+
+  if (pt >= end)
+    return end;
+
+  nbytes = (end + 7) >> 3;
+  i      = pt >> 3;
+  base   = pt & ~7;
+
+  w = (loadword(bm + i, nbytes - i) ^ flip) & (ALLBITS >> (pt & 7));
+
+  /* skip whole words that are entirely flip */
+
+  while (w == 0)
+    {
+      i    += WORDSZ;
+      base += WORDBITS;
+
+      if (i >= nbytes)
+	return end;
+
+      w = loadword(bm + i, nbytes - i) ^ flip;
+    }
+
+  pt = base + CLZ(w);
+
+  return pt < end ? pt : end;
+}
+
+/*
+ * NAME:	bitmap->findset()
+ * DESCRIPTION:	return the first set bit in [pt, end), or end if none
+ */
+unsigned int bm_findset(const byte *bm, unsigned int pt, unsigned int end)
+{
+  return findbit(bm, pt, end, 0);
+}
+
+/*
+ * NAME:	bitmap->findclr()
+ * DESCRIPTION:	return the first clear bit in [pt, end), or end if none
+ */
+unsigned int bm_findclr(const byte *bm, unsigned int pt, unsigned int end)
+{
+  return findbit(bm, pt, end, ALLBITS);
+}
+
+/*
+ * NAME:	bitmap->rfindset()
+ * DESCRIPTION:	return one past the last set bit before pt, or 0 if none
+ */
+unsigned int bm_rfindset(const byte *bm, unsigned int pt)
+{
+  unsigned long w;
+
+  for ( ; pt & 7; --pt)
+    {
+      if (BMTST(bm, pt - 1))
+	return pt;
+    }
+
+  for ( ; pt >= WORDBITS; pt -= WORDBITS)
+    {
+      w = loadword(bm + (pt >> 3) - WORDSZ, WORDSZ);
+      if (w)
+	return pt - CTZ(w);
+    }
+
+  for ( ; pt > 0; pt -= 8)
+    {
+      w = bm[(pt >> 3) - 1];
+      if (w)
+	return pt - CTZ(w);
+    }
+
+  return 0;
+}
+
+/*
+ * NAME:	bitmap->count()
+ * DESCRIPTION:	return the number of set bits in [pt, end)
+ */
+unsigned int bm_count(const byte *bm, unsigned int pt, unsigned int end)
+{
+  unsigned int count = 0;
+
+  for ( ; pt < end && (pt & 7); ++pt)
+    {
+      if (BMTST(bm, pt))
+	++count;
+    }
+
+  for ( ; end - pt >= WORDBITS; pt += WORDBITS)
+    count += POPCOUNT(loadword(bm + (pt >> 3), WORDSZ));
+
+  for ( ; pt < end; ++pt)
+    {
+      if (BMTST(bm, pt))
+	++count;
+    }
+
+  return count;
+}
+
+/*
+ * NAME:	fillrange()
+ * DESCRIPTION:	set or clear a range of bits a byte at a time
+ */
+static
+void fillrange(byte *bm, unsigned int pt, unsigned int end, int set)
+{
+  byte *ptr, *last;
+  unsigned int head, tail;
+
+  if (pt >= end)
+    return;
+
+  ptr  = bm + (pt >> 3);
+  last = bm + ((end - 1) >> 3);
+
+  /* masks for the bits of the first and last bytes within the range */
+
+  head = 0xff >> (pt & 7);
+  tail = (0xff << (7 - ((end - 1) & 7))) & 0xff;
+
+  if (ptr == last)
+    head &= tail;
+  else
+    {
+      memset(ptr + 1, set ? 0xff : 0x00, last - ptr - 1);
+
+      if (set)
+	*last |= tail;
+      else
+	*last &= ~tail;
+    }
+
+  if (set)
+    *ptr |= head;
+  else
+    *ptr &= ~head;
+}
+
+/*
+ * NAME:	bitmap->setrange()
+ * DESCRIPTION:	set all bits from pt up to (not including) end
+ */
+void bm_setrange(byte *bm, unsigned int pt, unsigned int end)
+{
+  fillrange(bm, pt, end, 1);
+}
+
+/*
+ * NAME:	bitmap->clrrange()
+ * DESCRIPTION:	clear all bits from pt up to (not including) end
+ */
+void bm_clrrange(byte *bm, unsigned int pt, unsigned int end)
+{
+  fillrange(bm, pt, end, 0);
+}
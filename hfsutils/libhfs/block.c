@@ -30,35 +30,139 @@
 # include "libhfs.h"
 # include "volume.h"
 # include "block.h"
-# include "os.h"
+# include "bitmap.h"
 
 # define INUSE(b)	((b)->flags & HFS_BUCKET_INUSE)
 # define DIRTY(b)	((b)->flags & HFS_BUCKET_DIRTY)
 
+/*
+ * NAME:	clearghosts()
+ * DESCRIPTION:	forget all blocks remembered in a cache's ghost ring
+ */
+static
+void clearghosts(bcache *cache)
+{
+  unsigned int i;
+
+  for (i = 0; i < cache->gmax; ++i)
+    {
+      cache->ghosts[i].bnum  = (unsigned long) -1;
+      cache->ghosts[i].hnext = -1;
+    }
+
+  for (i = 0; i < cache->hashsz; ++i)
+    cache->ghash[i] = -1;
+
+  cache->gpos      = 0;
+
+  cache->inhits    = 0;
+  cache->mainhits  = 0;
+  cache->ghosthits = 0;
+}
+
+/*
+ * NAME:	freecache()
+ * DESCRIPTION:	release the memory held by a block cache
+ */
+static
+void freecache(bcache *cache)
+{
+  FREE(cache->chain);
+  FREE(cache->hash);
+  FREE(cache->list);
+  FREE(cache->runs);
+  FREE(cache->bufs);
+  FREE(cache->reqs);
+  FREE(cache->pool);
+
+  FREE(cache->ghosts);
+  FREE(cache->ghash);
+
+  FREE(cache->rachain);
+  FREE(cache->raslots);
+
+  LOCKFREE(cache->lock);
+
+  FREE(cache);
+}
+
 /*
  * NAME:	block->init()
- * DESCRIPTION:	initialize a volume's block cache
+ * DESCRIPTION:	initialize a volume's block cache with the given bucket count
  */
-int b_init(hfsvol *vol)
+int b_init(hfsvol *vol, unsigned int size)
 {
   bcache *cache;
-  int i;
+  unsigned int i;
 
   ASSERT(vol->cache == 0);
 
+  if (size < HFS_BLOCKBUFSZ)
+    size = HFS_BLOCKBUFSZ;
+
   cache = ALLOC(bcache, 1);
   if (cache == 0)
     ERROR(ENOMEM, 0);
 
+  LOCKINIT(cache->lock);
+
+  cache->size   = size;
+
+  for (cache->hashsz = 1; cache->hashsz * HFS_HASHLOAD < size; )
+    cache->hashsz <<= 1;
+
+  cache->chain  = ALLOC(bucket,   size);
+  cache->hash   = ALLOC(bucket *, cache->hashsz);
+  cache->list   = ALLOC(bucket *, size);
+  cache->runs   = ALLOC(bucket *, size);
+  cache->bufs   = ALLOC(void *,   size);
+  cache->reqs   = ALLOC(hfsioreq, size);
+  cache->pool   = ALLOC(block,    size);
+
+  cache->inmax  = size >> 2;
+  cache->gmax   = size >> 1;
+
+  cache->ghosts = ALLOC(ghost, cache->gmax);
+  cache->ghash  = ALLOC(int,   cache->hashsz);
+
+  cache->ramax  = size >> 1;
+  if (cache->ramax > HFS_RAMAX)
+    cache->ramax = HFS_RAMAX;
+
+  cache->rachain = ALLOC(bucket *,   cache->ramax);
+  cache->raslots = ALLOC(bucket **,  cache->ramax);
+
+  if (cache->chain  == 0 || cache->hash  == 0 ||
+      cache->list   == 0 || cache->pool  == 0 ||
+      cache->runs   == 0 || cache->bufs  == 0 || cache->reqs == 0 ||
+      cache->ghosts == 0 || cache->ghash == 0 ||
+      cache->rachain == 0 || cache->raslots == 0)
+    {
+      freecache(cache);
+      ERROR(ENOMEM, 0);
+    }
+
   vol->cache = cache;
 
   cache->vol    = vol;
-  cache->tail   = &cache->chain[HFS_CACHESZ - 1];
+  cache->tail   = &cache->chain[size - 1];
+  cache->policy = HFS_CACHE_CLASSIC;
 
   cache->hits   = 0;
   cache->misses = 0;
 
-  for (i = 0; i < HFS_CACHESZ; ++i)
+  cache->intail = 0;
+  cache->inlen  = 0;
+
+  cache->ranext = (unsigned long) -1;
+  cache->rawin  = HFS_BLOCKBUFSZ >> 1;
+  cache->rapeak = cache->rawin;
+
+  cache->rablocks = 0;
+  cache->rahits   = 0;
+  cache->rawasted = 0;
+
+  for (i = 0; i < size; ++i)
     {
       bucket *b = &cache->chain[i];
 
@@ -78,9 +182,108 @@ int b_init(hfsvol *vol)
   cache->chain[0].cprev = cache->tail;
   cache->tail->cnext    = &cache->chain[0];
 
-  for (i = 0; i < HFS_HASHSZ; ++i)
+  for (i = 0; i < cache->hashsz; ++i)
     cache->hash[i] = 0;
 
+  clearghosts(cache);
+
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	block->resize()
+ * DESCRIPTION:	replace a volume's block cache with one of another size
+ */
+int b_resize(hfsvol *vol, unsigned int size)
+{
+  bcache *old = vol->cache;
+
+  /* commit the old cache, but keep it until its successor exists */
+
+  if (old && b_flush(vol) == -1)
+    goto fail;
+
+  vol->cache = 0;
+
+  if (size > 0 && b_init(vol, size) == -1)
+    {
+      vol->cache = old;
+      goto fail;
+    }
+
+  if (old)
+    {
+      if (vol->cache)
+	b_setpolicy(vol, old->policy);
+
+      freecache(old);
+    }
+
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	block->setpolicy()
+ * DESCRIPTION:	change the replacement policy of a volume's block cache
+ */
+int b_setpolicy(hfsvol *vol, int policy)
+{
+  bcache *cache = vol->cache;
+  unsigned int i;
+
+  if (policy != HFS_CACHE_CLASSIC && policy != HFS_CACHE_2Q)
+    ERROR(EINVAL, "unknown cache policy");
+
+  if (cache == 0 || cache->policy == policy)
+    goto done;
+
+  LOCK(cache->lock);
+
+  /* fold the A1in queue back into the main chain */
+
+  if (cache->intail)
+    {
+      bucket *head = cache->tail->cnext, *inhead = cache->intail->cnext;
+
+      cache->tail->cnext   = inhead;
+      inhead->cprev        = cache->tail;
+
+      cache->intail->cnext = head;
+      head->cprev          = cache->intail;
+
+      cache->tail   = cache->intail;
+      cache->intail = 0;
+    }
+
+  for (i = 0; i < cache->size; ++i)
+    {
+      cache->chain[i].flags &= ~(HFS_BUCKET_A1IN | HFS_BUCKET_AHEAD |
+				 HFS_BUCKET_GHOST);
+      cache->chain[i].count  = 1;
+    }
+
+  cache->inlen  = 0;
+
+  clearghosts(cache);
+
+  cache->policy = policy;
+
+  cache->hits      = 0;
+  cache->misses    = 0;
+
+  cache->rablocks  = 0;
+  cache->rahits    = 0;
+  cache->rawasted  = 0;
+
+  UNLOCK(cache->lock);
+
+done:
   return 0;
 
 fail:
@@ -100,17 +303,15 @@ void b_showstats(const bcache *cache)
 }
 
 /*
- * NAME:	block->dumpcache()
- * DESCRIPTION:	dump the cache tables for a volume
+ * NAME:	dumpqueue()
+ * DESCRIPTION:	dump the buckets of one cache chain
  */
-void b_dumpcache(const bcache *cache)
+static
+void dumpqueue(const bucket *tail)
 {
   const bucket *b;
-  int i;
-
-  fprintf(stderr, "BLOCK CACHE DUMP:\n");
 
-  for (i = 0, b = cache->tail->cnext; i < HFS_CACHESZ; ++i, b = b->cnext)
+  for (b = tail->cnext; ; b = b->cnext)
     {
       if (INUSE(b))
 	{
@@ -120,20 +321,43 @@ void b_dumpcache(const bcache *cache)
 
 	  fprintf(stderr, ":%u", b->count);
 	}
+
+      if (b == tail)
+	break;
     }
 
   fprintf(stderr, "\n");
+}
+
+/*
+ * NAME:	block->dumpcache()
+ * DESCRIPTION:	dump the cache tables for a volume
+ */
+void b_dumpcache(const bcache *cache)
+{
+  const bucket *b;
+  unsigned int i;
+
+  fprintf(stderr, "BLOCK CACHE DUMP:\n");
+
+  dumpqueue(cache->tail);
+
+  if (cache->intail)
+    {
+      fprintf(stderr, "BLOCK CACHE A1IN DUMP:\n");
+      dumpqueue(cache->intail);
+    }
 
   fprintf(stderr, "BLOCK HASH DUMP:\n");
 
-  for (i = 0; i < HFS_HASHSZ; ++i)
+  for (i = 0; i < cache->hashsz; ++i)
     {
       int seen = 0;
 
       for (b = cache->hash[i]; b; b = b->hnext)
 	{
 	  if (! seen)
-	    fprintf(stderr, "  %d:", i);
+	    fprintf(stderr, "  %u:", i);
 
 	  if (INUSE(b))
 	    {
@@ -154,78 +378,20 @@ void b_dumpcache(const bcache *cache)
 # endif
 
 /*
- * NAME:	fillchain()
- * DESCRIPTION:	fill a chain of bucket buffers with a single read
- */
-static
-int fillchain(hfsvol *vol, bucket **bptr, unsigned int *count)
-{
-  bucket *blist[HFS_BLOCKBUFSZ], **start = bptr;
-  unsigned long bnum;
-  unsigned int len, i;
-
-  for (len = 0; len < HFS_BLOCKBUFSZ &&
-	 (unsigned int) (bptr - start) < *count; ++bptr)
-    {
-      if (INUSE(*bptr))
-	continue;
-
-      if (len > 0 && (*bptr)->bnum != bnum)
-	break;
-
-      blist[len++] = *bptr;
-      bnum = (*bptr)->bnum + 1;
-    }
-
-  *count = bptr - start;
-
-  if (len == 0)
-    goto done;
-  else if (len == 1)
-    {
-      if (b_readpb(vol, vol->vstart + blist[0]->bnum,
-		   blist[0]->data, 1) == -1)
-	goto fail;
-    }
-  else
-    {
-      block buffer[HFS_BLOCKBUFSZ];
-
-      if (b_readpb(vol, vol->vstart + blist[0]->bnum, buffer, len) == -1)
-	goto fail;
-
-      for (i = 0; i < len; ++i)
-	memcpy(blist[i]->data, buffer[i], HFS_BLOCKSZ);
-    }
-
-  for (i = 0; i < len; ++i)
-    {
-      blist[i]->flags |=  HFS_BUCKET_INUSE;
-      blist[i]->flags &= ~HFS_BUCKET_DIRTY;
-    }
-
-done:
-  return 0;
-
-fail:
-  return -1;
-}
-
-/*
- * NAME:	flushchain()
- * DESCRIPTION:	store a chain of bucket buffers with a single write
+ * NAME:	getrun()
+ * DESCRIPTION:	gather a run of consecutive buckets to be filled or flushed
  */
 static
-int flushchain(hfsvol *vol, bucket **bptr, unsigned int *count)
+unsigned int getrun(bucket **bptr, unsigned int *count, int flush,
+		    bucket **blist)
 {
-  bucket *blist[HFS_BLOCKBUFSZ], **start = bptr;
+  bucket **start = bptr;
   unsigned long bnum;
-  unsigned int len, i;
+  unsigned int len;
 
-  for (len = 0; len < HFS_BLOCKBUFSZ &&
-	 (unsigned int) (bptr - start) < *count; ++bptr)
+  for (len = 0; (unsigned int) (bptr - start) < *count; ++bptr)
     {
-      if (! INUSE(*bptr) || ! DIRTY(*bptr))
+      if (flush ? (! INUSE(*bptr) || ! DIRTY(*bptr)) : INUSE(*bptr))
 	continue;
 
       if (len > 0 && (*bptr)->bnum != bnum)
@@ -237,33 +403,7 @@ int flushchain(hfsvol *vol, bucket **bptr, unsigned int *count)
 
   *count = bptr - start;
 
-  if (len == 0)
-    goto done;
-  else if (len == 1)
-    {
-      if (b_writepb(vol, vol->vstart + blist[0]->bnum,
-		    blist[0]->data, 1) == -1)
-	goto fail;
-    }
-  else
-    {
-      block buffer[HFS_BLOCKBUFSZ];
-
-      for (i = 0; i < len; ++i)
-	memcpy(buffer[i], blist[i]->data, HFS_BLOCKSZ);
-
-      if (b_writepb(vol, vol->vstart + blist[0]->bnum, buffer, len) == -1)
-	goto fail;
-    }
-
-  for (i = 0; i < len; ++i)
-    blist[i]->flags &= ~HFS_BUCKET_DIRTY;
-
-done:
-  return 0;
-
-fail:
-  return -1;
+  return len;
 }
 
 /*
@@ -290,27 +430,63 @@ int compare(const bucket **b1, const bucket **b2)
  * DESCRIPTION:	fill or flush an array of cache buckets to a volume
  */
 static
-int dobuckets(hfsvol *vol, bucket **chain, unsigned int len,
-	      int (*func)(hfsvol *, bucket **, unsigned int *))
+int dobuckets(hfsvol *vol, bucket **chain, unsigned int len, int flush)
 {
-  unsigned int count, i;
+  bcache *cache = vol->cache;
+  bucket **blist = cache->runs;
+  hfsioreq *req;
+  unsigned int count, nbufs, nreqs, i, j;
   int result = 0;
 
   qsort(chain, len, sizeof(*chain),
 	(int (*)(const void *, const void *)) compare);
 
-  for (i = 0; i < len; i += count)
+  /* gather every run into a single batch of transfers */
+
+  for (nbufs = nreqs = 0, i = 0; i < len; i += count)
     {
+      unsigned int rlen;
+
       count = len - i;
-      if (func(vol, chain + i, &count) == -1)
-	result = -1;
+      rlen  = getrun(chain + i, &count, flush, blist + nbufs);
+      if (rlen == 0)
+	continue;
+
+      req = &cache->reqs[nreqs++];
+
+      req->write = flush;
+      req->bnum  = vol->vstart + blist[nbufs]->bnum;
+      req->len   = rlen;
+      req->bufs  = cache->bufs + nbufs;
+
+      for (j = 0; j < rlen; ++j, ++nbufs)
+	cache->bufs[nbufs] = blist[nbufs]->data;
+    }
+
+  if (nreqs == 0)
+    goto done;
+
+  if (b_transfer(vol, cache->reqs, nreqs) == -1)
+    result = -1;
+
+  for (req = cache->reqs; req < cache->reqs + nreqs; blist += req++->len)
+    {
+      if (req->count != req->len)
+	continue;
+
+      for (j = 0; j < req->len; ++j)
+	{
+	  blist[j]->flags |=  HFS_BUCKET_INUSE;
+	  blist[j]->flags &= ~HFS_BUCKET_DIRTY;
+	}
     }
 
+done:
   return result;
 }
 
-# define fillbuckets(vol, chain, len)	dobuckets(vol, chain, len, fillchain)
-# define flushbuckets(vol, chain, len)	dobuckets(vol, chain, len, flushchain)
+# define fillbuckets(vol, chain, len)	dobuckets(vol, chain, len, 0)
+# define flushbuckets(vol, chain, len)	dobuckets(vol, chain, len, 1)
 
 /*
  * NAME:	block->flush()
@@ -319,17 +495,23 @@ int dobuckets(hfsvol *vol, bucket **chain, unsigned int len,
 int b_flush(hfsvol *vol)
 {
   bcache *cache = vol->cache;
-  bucket *chain[HFS_CACHESZ];
-  int i;
+  unsigned int i;
 
   if (cache == 0 || (vol->flags & HFS_VOL_READONLY))
     goto done;
 
-  for (i = 0; i < HFS_CACHESZ; ++i)
-    chain[i] = &cache->chain[i];
+  LOCK(cache->lock);
 
-  if (flushbuckets(vol, chain, HFS_CACHESZ) == -1)
-    goto fail;
+  for (i = 0; i < cache->size; ++i)
+    cache->list[i] = &cache->chain[i];
+
+  if (flushbuckets(vol, cache->list, cache->size) == -1)
+    {
+      UNLOCK(cache->lock);
+      goto fail;
+    }
+
+  UNLOCK(cache->lock);
 
 done:
 # ifdef DEBUG
@@ -360,7 +542,7 @@ int b_finish(hfsvol *vol)
 
   result = b_flush(vol);
 
-  FREE(vol->cache);
+  freecache(vol->cache);
   vol->cache = 0;
 
 done:
@@ -376,7 +558,7 @@ bucket *findbucket(bcache *cache, unsigned long bnum, bucket ***hslot)
 {
   bucket *b;
 
-  *hslot = &cache->hash[bnum & (HFS_HASHSZ - 1)];
+  *hslot = &cache->hash[bnum & (cache->hashsz - 1)];
 
   for (b = **hslot; b; b = b->hnext)
     {
@@ -388,80 +570,340 @@ bucket *findbucket(bcache *cache, unsigned long bnum, bucket ***hslot)
 }
 
 /*
- * NAME:	reuse()
- * DESCRIPTION:	free a bucket for reuse, flushing if necessary
+ * NAME:	findghost()
+ * DESCRIPTION:	locate a block in the ghost ring, and/or its hash slot
  */
 static
-int reuse(bcache *cache, bucket *b, unsigned long bnum)
+int *findghost(bcache *cache, unsigned long bnum, int index)
 {
-  bucket *chain[HFS_BLOCKBUFSZ], *bptr;
-  int i;
-
-# ifdef DEBUG
-  if (INUSE(b))
-    fprintf(stderr, "BLOCK: CACHE reusing bucket containing "
-	    "vol 0x%lx block %lu:%u\n",
-	    (unsigned long) cache->vol, b->bnum, b->count);
-# endif
+  int *gptr;
 
-  if (INUSE(b) && DIRTY(b))
+  for (gptr = &cache->ghash[bnum & (cache->hashsz - 1)]; *gptr != -1;
+       gptr = &cache->ghosts[*gptr].hnext)
     {
-      /* flush most recently unused buckets */
+      if (index >= 0 ? *gptr == index : cache->ghosts[*gptr].bnum == bnum)
+	break;
+    }
 
-      for (bptr = b, i = 0; i < HFS_BLOCKBUFSZ; ++i)
-	{
-	  chain[i] = bptr;
-	  bptr = bptr->cprev;
-	}
+  return gptr;
+}
 
-      if (flushbuckets(cache->vol, chain, HFS_BLOCKBUFSZ) == -1)
-	goto fail;
+/*
+ * NAME:	addghost()
+ * DESCRIPTION:	remember a block evicted from the A1in queue
+ */
+static
+void addghost(bcache *cache, unsigned long bnum)
+{
+  ghost *g = &cache->ghosts[cache->gpos];
+  int *gptr;
+
+  if (cache->gmax == 0)
+    return;
+
+  if (g->bnum != (unsigned long) -1)
+    {
+      gptr  = findghost(cache, g->bnum, cache->gpos);
+      *gptr = g->hnext;
     }
 
-  b->flags &= ~HFS_BUCKET_INUSE;
-  b->count  = 1;
-  b->bnum   = bnum;
+  gptr = &cache->ghash[bnum & (cache->hashsz - 1)];
 
-  return 0;
+  g->bnum  = bnum;
+  g->hnext = *gptr;
+  *gptr    = cache->gpos;
 
-fail:
-  return -1;
+  cache->gpos = (cache->gpos + 1) % cache->gmax;
 }
 
 /*
- * NAME:	cplace()
- * DESCRIPTION:	move a bucket to an appropriate place near head of the chain
+ * NAME:	delghost()
+ * DESCRIPTION:	forget a block if it is in the ghost ring; return true if so
  */
 static
-void cplace(bcache *cache, bucket *b)
+int delghost(bcache *cache, unsigned long bnum)
 {
-  bucket *p;
-
-  for (p = cache->tail->cnext; p->count > 1; p = p->cnext)
-    --p->count;
+  int *gptr;
+  ghost *g;
 
-  b->cnext->cprev = b->cprev;
-  b->cprev->cnext = b->cnext;
+  gptr = findghost(cache, bnum, -1);
+  if (*gptr == -1)
+    return 0;
 
-  if (cache->tail == b)
-    cache->tail = b->cprev;
+  g = &cache->ghosts[*gptr];
 
-  b->cprev = p->cprev;
-  b->cnext = p;
+  *gptr    = g->hnext;
+  g->bnum  = (unsigned long) -1;
+  g->hnext = -1;
 
-  p->cprev->cnext = b;
-  p->cprev = b;
+  return 1;
 }
 
 /*
- * NAME:	hplace()
- * DESCRIPTION:	move a bucket to the head of its hash slot
+ * NAME:	dequeue()
+ * DESCRIPTION:	remove a bucket from a circular queue
  */
 static
-void hplace(bucket **hslot, bucket *b)
+void dequeue(bucket **tail, bucket *b)
 {
-  if (*hslot != b)
-    {
+  if (*tail == b)
+    *tail = (b->cprev == b) ? 0 : b->cprev;
+
+  b->cnext->cprev = b->cprev;
+  b->cprev->cnext = b->cnext;
+
+  b->cnext = b->cprev = b;
+}
+
+/*
+ * NAME:	enqueue()
+ * DESCRIPTION:	insert a bucket at the head of a circular queue
+ */
+static
+void enqueue(bucket **tail, bucket *b)
+{
+  if (*tail == 0)
+    {
+      b->cnext = b->cprev = b;
+      *tail = b;
+    }
+  else
+    {
+      b->cprev = *tail;
+      b->cnext = (*tail)->cnext;
+
+      (*tail)->cnext->cprev = b;
+      (*tail)->cnext = b;
+    }
+}
+
+/*
+ * NAME:	retire()
+ * DESCRIPTION:	detach a 2Q bucket from its queue before reuse
+ */
+static
+void retire(bcache *cache, bucket *b)
+{
+  if (b->flags & HFS_BUCKET_A1IN)
+    {
+      if (INUSE(b))
+	addghost(cache, b->bnum);
+
+      dequeue(&cache->intail, b);
+      --cache->inlen;
+
+      b->flags &= ~HFS_BUCKET_A1IN;
+    }
+  else
+    dequeue(&cache->tail, b);
+}
+
+/*
+ * NAME:	reuse()
+ * DESCRIPTION:	free a bucket for reuse, flushing if necessary
+ */
+static
+int reuse(bcache *cache, bucket *b, unsigned long bnum)
+{
+  bucket *chain[HFS_BLOCKBUFSZ], *bptr;
+  int i;
+
+# ifdef DEBUG
+  if (INUSE(b))
+    fprintf(stderr, "BLOCK: CACHE reusing bucket containing "
+	    "vol 0x%lx block %lu:%u\n",
+	    (unsigned long) cache->vol, b->bnum, b->count);
+# endif
+
+  if (INUSE(b) && DIRTY(b))
+    {
+      /* flush most recently unused buckets */
+
+      for (bptr = b, i = 0; i < HFS_BLOCKBUFSZ; ++i)
+	{
+	  chain[i] = bptr;
+	  bptr = bptr->cprev;
+	}
+
+      if (flushbuckets(cache->vol, chain, HFS_BLOCKBUFSZ) == -1)
+	goto fail;
+    }
+
+  if (cache->policy == HFS_CACHE_2Q)
+    retire(cache, b);
+
+  if (INUSE(b) && (b->flags & HFS_BUCKET_AHEAD))
+    ++cache->rawasted;
+
+  b->flags &= ~(HFS_BUCKET_INUSE | HFS_BUCKET_AHEAD | HFS_BUCKET_GHOST);
+  b->count  = 1;
+  b->bnum   = bnum;
+
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	victim()
+ * DESCRIPTION:	choose the next bucket to be reused
+ */
+static
+bucket *victim(bcache *cache, bucket *prev)
+{
+  if (cache->policy == HFS_CACHE_2Q)
+    {
+      /* evict from A1in only once it has outgrown its share */
+
+      if (cache->intail &&
+	  (cache->inlen > cache->inmax || cache->tail == 0))
+	return cache->intail;
+
+      return cache->tail;
+    }
+
+  return prev ? prev->cprev : cache->tail;
+}
+
+/*
+ * NAME:	cplace()
+ * DESCRIPTION:	move a bucket to an appropriate place near head of the chain
+ */
+static
+void cplace(bcache *cache, bucket *b)
+{
+  bucket *p;
+
+  for (p = cache->tail->cnext; p->count > 1; p = p->cnext)
+    --p->count;
+
+  /* already in place; relinking it before itself would detach it */
+
+  if (p == b)
+    return;
+
+  b->cnext->cprev = b->cprev;
+  b->cprev->cnext = b->cnext;
+
+  if (cache->tail == b)
+    cache->tail = b->cprev;
+
+  b->cprev = p->cprev;
+  b->cnext = p;
+
+  p->cprev->cnext = b;
+  p->cprev = b;
+}
+
+/*
+ * NAME:	place()
+ * DESCRIPTION:	enter a newly reused bucket into the cache chain(s)
+ */
+static
+void place(bcache *cache, bucket *b)
+{
+  if (cache->policy == HFS_CACHE_2Q)
+    {
+      /* blocks evicted recently enough to be remembered are hot, but a
+	 prefetched block waits in A1in until it is really referenced */
+
+      if (delghost(cache, b->bnum))
+	{
+	  if (! (b->flags & HFS_BUCKET_AHEAD))
+	    {
+	      ++cache->ghosthits;
+	      enqueue(&cache->tail, b);
+
+	      return;
+	    }
+
+	  b->flags |= HFS_BUCKET_GHOST;
+	}
+
+      b->flags |= HFS_BUCKET_A1IN;
+      enqueue(&cache->intail, b);
+      ++cache->inlen;
+    }
+  else
+    cplace(cache, b);
+}
+
+/*
+ * NAME:	promote()
+ * DESCRIPTION:	move a prefetched 2Q bucket remembered as hot to the main queue
+ */
+static
+void promote(bcache *cache, bucket *b)
+{
+  b->flags &= ~HFS_BUCKET_GHOST;
+
+  if (b->flags & HFS_BUCKET_A1IN)
+    {
+      dequeue(&cache->intail, b);
+      --cache->inlen;
+
+      b->flags &= ~HFS_BUCKET_A1IN;
+
+      enqueue(&cache->tail, b);
+    }
+
+  ++cache->ghosthits;
+}
+
+/*
+ * NAME:	touch()
+ * DESCRIPTION:	update the cache chain(s) following a hit on a bucket
+ */
+static
+void touch(bcache *cache, bucket *b)
+{
+  bucket *p;
+
+  if (cache->policy == HFS_CACHE_2Q)
+    {
+      /* A1in is a FIFO; correlated references do not promote */
+
+      if (b->flags & HFS_BUCKET_A1IN)
+	++cache->inhits;
+      else
+	{
+	  ++cache->mainhits;
+
+	  dequeue(&cache->tail, b);
+	  enqueue(&cache->tail, b);
+	}
+    }
+  else if (++b->count > b->cprev->count &&
+	   b != cache->tail->cnext)
+    {
+      /* move towards head of cache chain */
+
+      p = b->cprev;
+
+      p->cprev->cnext = b;
+      b->cnext->cprev = p;
+
+      p->cnext = b->cnext;
+      b->cprev = p->cprev;
+
+      p->cprev = b;
+      b->cnext = p;
+
+      if (cache->tail == b)
+	cache->tail = p;
+    }
+}
+
+/*
+ * NAME:	hplace()
+ * DESCRIPTION:	move a bucket to the head of its hash slot
+ */
+static
+void hplace(bucket **hslot, bucket *b)
+{
+  if (*hslot != b)
+    {
       if (b->hprev)
 	*b->hprev = b->hnext;
       if (b->hnext)
@@ -477,6 +919,30 @@ void hplace(bucket **hslot, bucket *b)
     }
 }
 
+/*
+ * NAME:	readahead()
+ * DESCRIPTION:	update the stream detector on a miss and return the window
+ */
+static
+unsigned int readahead(bcache *cache, unsigned long bnum)
+{
+  if (bnum >= cache->ranext && bnum - cache->ranext < cache->rawin)
+    {
+      /* the miss continues a sequential scan; widen the window */
+
+      cache->rawin <<= 1;
+      if (cache->rawin > cache->ramax)
+	cache->rawin = cache->ramax;
+
+      if (cache->rawin > cache->rapeak)
+	cache->rapeak = cache->rawin;
+    }
+  else if (cache->rawin > 1)
+    cache->rawin >>= 1;
+
+  return cache->rawin;
+}
+
 /*
  * NAME:	getbucket()
  * DESCRIPTION:	fetch a bucket from the cache, or an empty one to be filled
@@ -484,34 +950,30 @@ void hplace(bucket **hslot, bucket *b)
 static
 bucket *getbucket(bcache *cache, unsigned long bnum, int fill)
 {
-  bucket **hslot, *b, *p, *bptr,
-    *chain[HFS_BLOCKBUFSZ], **slots[HFS_BLOCKBUFSZ];
+  bucket **hslot, *b, *bptr,
+    **chain = cache->rachain, ***slots = cache->raslots;
+  unsigned int len = 0, window;
 
   b = findbucket(cache, bnum, &hslot);
 
   if (b)
     {
-      /* cache hit; move towards head of cache chain */
+      /* cache hit */
 
       ++cache->hits;
 
-      if (++b->count > b->cprev->count &&
-	  b != cache->tail->cnext)
+      if (b->flags & HFS_BUCKET_AHEAD)
 	{
-	  p = b->cprev;
-
-	  p->cprev->cnext = b;
-	  b->cnext->cprev = p;
-
-	  p->cnext = b->cnext;
-	  b->cprev = p->cprev;
+	  b->flags &= ~HFS_BUCKET_AHEAD;
+	  ++cache->rahits;
+	}
 
-	  p->cprev = b;
-	  b->cnext = p;
+      /* the first real reference settles a prefetched ghost */
 
-	  if (cache->tail == b)
-	    cache->tail = p;
-	}
+      if (b->flags & HFS_BUCKET_GHOST)
+	promote(cache, b);
+      else
+	touch(cache, b);
     }
   else
     {
@@ -519,47 +981,58 @@ bucket *getbucket(bcache *cache, unsigned long bnum, int fill)
 
       ++cache->misses;
 
-      b = cache->tail;
+      b = victim(cache, 0);
 
       if (reuse(cache, b, bnum) == -1)
 	goto fail;
 
+      chain[len]   = b;
+      slots[len++] = hslot;
+
       if (fill)
 	{
-	  unsigned int len = 0;
+	  window = readahead(cache, bnum);
 
-	  chain[len]   = b;
-	  slots[len++] = hslot;
-
-	  for (bptr = b->cprev;
-	       len < (HFS_BLOCKBUFSZ >> 1) && ++bnum < cache->vol->vlen;
-	       bptr = bptr->cprev)
+	  for (bptr = b; len < window && ++bnum < cache->vol->vlen; )
 	    {
 	      if (findbucket(cache, bnum, &hslot))
 		break;
 
+	      bptr = victim(cache, bptr);
+
 	      if (reuse(cache, bptr, bnum) == -1)
 		goto fail;
 
+	      bptr->flags |= HFS_BUCKET_AHEAD;
+
 	      chain[len]   = bptr;
 	      slots[len++] = hslot;
 	    }
 
+	  cache->ranext    = chain[len - 1]->bnum + 1;
+	  cache->rablocks += len - 1;
+
+	  /* the cache stays locked across this read, on purpose: the buckets
+	     are out of the chain and hash until placed below, and a thread
+	     missing on the same blocks must wait rather than read them
+	     again. Misses on an unmapped medium thus serialize; a mapped
+	     medium never comes here. */
+
 	  if (fillbuckets(cache->vol, chain, len) == -1)
 	    goto fail;
+	}
 
-	  while (--len)
-	    {
-	      cplace(cache, chain[len]);
-	      hplace(slots[len], chain[len]);
-	    }
+      /* move buckets to appropriate places in chain */
 
-	  hslot = slots[0];
+      while (--len)
+	{
+	  place(cache, chain[len]);
+	  hplace(slots[len], chain[len]);
 	}
 
-      /* move bucket to appropriate place in chain */
+      place(cache, b);
 
-      cplace(cache, b);
+      hslot = slots[0];
     }
 
   /* insert at front of hash chain */
@@ -569,6 +1042,17 @@ bucket *getbucket(bcache *cache, unsigned long bnum, int fill)
   return b;
 
 fail:
+  /* 2Q buckets already detached go to the end of Am for early reuse */
+
+  if (cache->policy == HFS_CACHE_2Q)
+    {
+      while (len--)
+	{
+	  enqueue(&cache->tail, chain[len]);
+	  cache->tail = chain[len];
+	}
+    }
+
   return 0;
 }
 
@@ -589,14 +1073,17 @@ int b_readpb(hfsvol *vol, unsigned long bnum, block *bp, unsigned int blen)
     fprintf(stderr, "\n");
 # endif
 
-  nblocks = os_seek(&vol->priv, bnum);
-  if (nblocks == (unsigned long) -1)
-    goto fail;
+  if (vol->map)
+    {
+      if (bnum >= vol->mapsz || blen > vol->mapsz - bnum)
+	ERROR(EIO, "incomplete block read");
 
-  if (nblocks != bnum)
-    ERROR(EIO, "block seek failed for read");
+      memcpy(bp, vol->map + bnum, (size_t) blen << HFS_BLOCKSZ_BITS);
 
-  nblocks = os_read(&vol->priv, bp, blen);
+      return 0;
+    }
+
+  nblocks = vol->io.read(vol->priv, bp, blen, bnum);
   if (nblocks == (unsigned long) -1)
     goto fail;
 
@@ -627,14 +1114,101 @@ int b_writepb(hfsvol *vol, unsigned long bnum, const block *bp,
     fprintf(stderr, "\n");
 # endif
 
-  nblocks = os_seek(&vol->priv, bnum);
+  nblocks = vol->io.write(vol->priv, bp, blen, bnum);
   if (nblocks == (unsigned long) -1)
     goto fail;
 
-  if (nblocks != bnum)
-    ERROR(EIO, "block seek failed for write");
+  if (nblocks != blen)
+    ERROR(EIO, "incomplete block write");
+
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	block->readpbv()
+ * DESCRIPTION:	read consecutive physical blocks into scattered buffers
+ */
+int b_readpbv(hfsvol *vol, unsigned long bnum, block *const bufs[],
+	      unsigned int blen)
+{
+  unsigned long nblocks;
+
+# ifdef DEBUG
+  fprintf(stderr, "BLOCK: READV vol 0x%lx block %lu+%u\n",
+	  (unsigned long) vol, bnum, blen);
+# endif
+
+  if (vol->map)
+    {
+      unsigned int i;
+
+      if (bnum >= vol->mapsz || blen > vol->mapsz - bnum)
+	ERROR(EIO, "incomplete block read");
+
+      for (i = 0; i < blen; ++i)
+	memcpy(bufs[i], vol->map + bnum + i, HFS_BLOCKSZ);
+
+      return 0;
+    }
+
+  if (vol->io.readv == 0)
+    {
+      unsigned int i;
+
+      for (i = 0; i < blen; ++i)
+	{
+	  if (b_readpb(vol, bnum + i, bufs[i], 1) == -1)
+	    goto fail;
+	}
+
+      return 0;
+    }
 
-  nblocks = os_write(&vol->priv, bp, blen);
+  nblocks = vol->io.readv(vol->priv, (void *const *) bufs, blen, bnum);
+  if (nblocks == (unsigned long) -1)
+    goto fail;
+
+  if (nblocks != blen)
+    ERROR(EIO, "incomplete block read");
+
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	block->writepbv()
+ * DESCRIPTION:	write consecutive physical blocks from scattered buffers
+ */
+int b_writepbv(hfsvol *vol, unsigned long bnum, const block *const bufs[],
+	       unsigned int blen)
+{
+  unsigned long nblocks;
+
+# ifdef DEBUG
+  fprintf(stderr, "BLOCK: WRITEV vol 0x%lx block %lu+%u\n",
+	  (unsigned long) vol, bnum, blen);
+# endif
+
+  if (vol->io.writev == 0)
+    {
+      unsigned int i;
+
+      for (i = 0; i < blen; ++i)
+	{
+	  if (b_writepb(vol, bnum + i, bufs[i], 1) == -1)
+	    goto fail;
+	}
+
+      return 0;
+    }
+
+  nblocks = vol->io.writev(vol->priv, (const void *const *) bufs,
+			   blen, bnum);
   if (nblocks == (unsigned long) -1)
     goto fail;
 
@@ -647,6 +1221,73 @@ fail:
   return -1;
 }
 
+/*
+ * NAME:	block->transfer()
+ * DESCRIPTION:	perform a batch of physical block transfers
+ */
+int b_transfer(hfsvol *vol, hfsioreq *reqs, unsigned int n)
+{
+  unsigned int i;
+  int result = 0;
+
+# ifdef DEBUG
+  fprintf(stderr, "BLOCK: BATCH vol 0x%lx %u transfers\n",
+	  (unsigned long) vol, n);
+# endif
+
+  if (n > 1 && vol->io.batch && vol->map == 0)
+    {
+      if (vol->io.batch(vol->priv, reqs, n) == -1)
+	goto fail;
+
+      for (i = 0; i < n; ++i)
+	{
+	  if (reqs[i].count == reqs[i].len)
+	    continue;
+
+	  if (reqs[i].count != (unsigned long) -1)
+	    {
+	      hfs_error = reqs[i].write ?
+		"incomplete block write" : "incomplete block read";
+	      errno = EIO;
+	    }
+
+	  result = -1;
+	}
+
+      return result;
+    }
+
+  for (i = 0; i < n; ++i)
+    {
+      hfsioreq *req = &reqs[i];
+      int status;
+
+      if (req->write)
+	status = b_writepbv(vol, req->bnum,
+			    (const block *const *) req->bufs, req->len);
+      else
+	status = b_readpbv(vol, req->bnum,
+			   (block *const *) req->bufs, req->len);
+
+      if (status == -1)
+	{
+	  req->count = -1;
+	  result = -1;
+	}
+      else
+	req->count = req->len;
+    }
+
+  return result;
+
+fail:
+  for (i = 0; i < n; ++i)
+    reqs[i].count = -1;
+
+  return -1;
+}
+
 /*
  * NAME:	block->readlb()
  * DESCRIPTION:	read a logical block from a volume (or from the cache)
@@ -656,15 +1297,20 @@ int b_readlb(hfsvol *vol, unsigned long bnum, block *bp)
   if (vol->vlen > 0 && bnum >= vol->vlen)
     ERROR(EIO, "read nonexistent logical block");
 
-  if (vol->cache)
+  if (vol->cache && vol->map == 0)
     {
       bucket *b;
 
+      LOCK(vol->cache->lock);
+
       b = getbucket(vol->cache, bnum, 1);
+      if (b)
+	memcpy(bp, b->data, HFS_BLOCKSZ);
+
+      UNLOCK(vol->cache->lock);
+
       if (b == 0)
 	goto fail;
-
-      memcpy(bp, b->data, HFS_BLOCKSZ);
     }
   else
     {
@@ -678,6 +1324,83 @@ fail:
   return -1;
 }
 
+/*
+ * NAME:	overlay()
+ * DESCRIPTION:	copy dirty cached blocks over a range read from the medium
+ */
+static
+void overlay(bcache *cache, unsigned long bnum, block *bp, unsigned int len)
+{
+  bucket **hslot, *b;
+  unsigned int i;
+
+  if (len < cache->size)
+    {
+      for (i = 0; i < len; ++i)
+	{
+	  b = findbucket(cache, bnum + i, &hslot);
+	  if (b && DIRTY(b))
+	    memcpy(&bp[i], b->data, HFS_BLOCKSZ);
+	}
+    }
+  else
+    {
+      for (i = 0; i < cache->size; ++i)
+	{
+	  b = &cache->chain[i];
+	  if (INUSE(b) && DIRTY(b) && b->bnum - bnum < len)
+	    memcpy(&bp[b->bnum - bnum], b->data, HFS_BLOCKSZ);
+	}
+    }
+}
+
+/*
+ * NAME:	block->readlbn()
+ * DESCRIPTION:	read consecutive logical blocks directly from a volume
+ */
+int b_readlbn(hfsvol *vol, unsigned long bnum, block *bp, unsigned int len)
+{
+  if (vol->vlen > 0 && (bnum >= vol->vlen || len > vol->vlen - bnum))
+    ERROR(EIO, "read nonexistent logical block");
+
+  if (b_readpb(vol, vol->vstart + bnum, bp, len) == -1)
+    goto fail;
+
+  /* pending changes in the cache supersede the medium */
+
+  if (vol->cache)
+    {
+      LOCK(vol->cache->lock);
+      overlay(vol->cache, bnum, bp, len);
+      UNLOCK(vol->cache->lock);
+    }
+
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	block->maplb()
+ * DESCRIPTION:	return a pointer to a logical block in a mapped volume
+ */
+const block *b_maplb(hfsvol *vol, unsigned long bnum)
+{
+  if (vol->vlen > 0 && bnum >= vol->vlen)
+    ERROR(EIO, "read nonexistent logical block");
+
+  bnum += vol->vstart;
+
+  if (vol->map == 0 || bnum >= vol->mapsz)
+    ERROR(EIO, "block not mapped");
+
+  return vol->map + bnum;
+
+fail:
+  return 0;
+}
+
 /*
  * NAME:	block->writelb()
  * DESCRIPTION:	write a logical block to a volume (or to the cache)
@@ -691,16 +1414,21 @@ int b_writelb(hfsvol *vol, unsigned long bnum, const block *bp)
     {
       bucket *b;
 
-      b = getbucket(vol->cache, bnum, 0);
-      if (b == 0)
-	goto fail;
+      LOCK(vol->cache->lock);
 
-      if (! INUSE(b) ||
-	  memcmp(b->data, bp, HFS_BLOCKSZ) != 0)
+      b = getbucket(vol->cache, bnum, 0);
+      if (b &&
+	  (! INUSE(b) ||
+	   memcmp(b->data, bp, HFS_BLOCKSZ) != 0))
 	{
 	  memcpy(b->data, bp, HFS_BLOCKSZ);
 	  b->flags |= HFS_BUCKET_INUSE | HFS_BUCKET_DIRTY;
 	}
+
+      UNLOCK(vol->cache->lock);
+
+      if (b == 0)
+	goto fail;
     }
   else
     {
@@ -714,6 +1442,32 @@ fail:
   return -1;
 }
 
+/*
+ * NAME:	inuse()
+ * DESCRIPTION:	return false if allocation blocks are known to be unused
+ */
+static
+int inuse(hfsvol *vol, unsigned int anum, unsigned int last)
+{
+  unsigned int i;
+
+  /* blocks are checked only against the parts of the bitmap read so far */
+
+  if (vol->vbm == 0)
+    return 1;
+
+  if (vol->vbmload)
+    {
+      for (i = HFS_VBMBLOCK(anum); i <= HFS_VBMBLOCK(last); ++i)
+	{
+	  if (! vol->vbmload[i])
+	    return 1;
+	}
+    }
+
+  return bm_findclr((const byte *) vol->vbm, anum, last + 1) > last;
+}
+
 /*
  * NAME:	block->readab()
  * DESCRIPTION:	read a block from an allocation block from a volume
@@ -724,7 +1478,7 @@ int b_readab(hfsvol *vol, unsigned int anum, unsigned int index, block *bp)
 
   if (anum >= vol->mdb.drNmAlBlks)
     ERROR(EIO, "read nonexistent allocation block");
-  else if (vol->vbm && ! BMTST(vol->vbm, anum))
+  else if (! inuse(vol, anum, anum))
     ERROR(EIO, "read unallocated block");
 
   return b_readlb(vol, vol->mdb.drAlBlSt + anum * vol->lpa + index, bp);
@@ -733,6 +1487,56 @@ fail:
   return -1;
 }
 
+/*
+ * NAME:	block->readabn()
+ * DESCRIPTION:	read consecutive blocks starting within an allocation block
+ */
+int b_readabn(hfsvol *vol, unsigned int anum, unsigned int index,
+	      block *bp, unsigned int len)
+{
+  unsigned int last;
+
+  /* verify the allocation blocks exist and are marked as in-use */
+
+  last = anum + (index + len - 1) / vol->lpa;
+
+  if (last >= vol->mdb.drNmAlBlks || last < anum)
+    ERROR(EIO, "read nonexistent allocation block");
+
+  if (! inuse(vol, anum, last))
+    ERROR(EIO, "read unallocated block");
+
+  return b_readlbn(vol, vol->mdb.drAlBlSt + anum * vol->lpa + index,
+		   bp, len);
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	block->mapab()
+ * DESCRIPTION:	locate a block of an allocation block in a mapped volume
+ */
+int b_mapab(hfsvol *vol, unsigned int anum, unsigned int index,
+	    const block **bpp)
+{
+  /* verify the allocation block exists and is marked as in-use */
+
+  if (anum >= vol->mdb.drNmAlBlks)
+    ERROR(EIO, "read nonexistent allocation block");
+  else if (! inuse(vol, anum, anum))
+    ERROR(EIO, "read unallocated block");
+
+  *bpp = b_maplb(vol, vol->mdb.drAlBlSt + anum * vol->lpa + index);
+  if (*bpp == 0)
+    goto fail;
+
+  return 0;
+
+fail:
+  return -1;
+}
+
 /*
  * NAME:	block->writeab()
  * DESCRIPTION:	write a block to an allocation block to a volume
@@ -744,7 +1548,7 @@ int b_writeab(hfsvol *vol,
 
   if (anum >= vol->mdb.drNmAlBlks)
     ERROR(EIO, "write nonexistent allocation block");
-  else if (vol->vbm && ! BMTST(vol->vbm, anum))
+  else if (! inuse(vol, anum, anum))
     ERROR(EIO, "write unallocated block");
 
   if (v_dirty(vol) == -1)
@@ -765,7 +1569,7 @@ unsigned long b_size(hfsvol *vol)
   unsigned long low, high, mid;
   block b;
 
-  high = os_seek(&vol->priv, -1);
+  high = vol->io.size ? vol->io.size(vol->priv) : 0;
 
   if (high != (unsigned long) -1 && high > 0)
     return high;
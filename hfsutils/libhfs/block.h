@@ -19,17 +19,28 @@
  * $Id: block.h,v 1.10 1998/11/02 22:08:53 rob Exp $
  */
 
-int b_init(hfsvol *);
+int b_init(hfsvol *, unsigned int);
+int b_resize(hfsvol *, unsigned int);
+int b_setpolicy(hfsvol *, int);
 int b_flush(hfsvol *);
 int b_finish(hfsvol *);
 
 int b_readpb(hfsvol *, unsigned long, block *, unsigned int);
 int b_writepb(hfsvol *, unsigned long, const block *, unsigned int);
 
+int b_readpbv(hfsvol *, unsigned long, block *const [], unsigned int);
+int b_writepbv(hfsvol *, unsigned long, const block *const [], unsigned int);
+
+int b_transfer(hfsvol *, hfsioreq *, unsigned int);
+
 int b_readlb(hfsvol *, unsigned long, block *);
+int b_readlbn(hfsvol *, unsigned long, block *, unsigned int);
+const block *b_maplb(hfsvol *, unsigned long);
 int b_writelb(hfsvol *, unsigned long, const block *);
 
 int b_readab(hfsvol *, unsigned int, unsigned int, block *);
+int b_readabn(hfsvol *, unsigned int, unsigned int, block *, unsigned int);
+int b_mapab(hfsvol *, unsigned int, unsigned int, const block **);
 int b_writeab(hfsvol *, unsigned int, unsigned int, const block *);
 
 unsigned long b_size(hfsvol *);
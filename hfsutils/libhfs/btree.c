@@ -33,6 +33,67 @@
 # include "file.h"
 # include "block.h"
 # include "node.h"
+# include "record.h"
+
+/*
+ * NAME:	keepnode()
+ * DESCRIPTION:	remember a parsed node in its B*-tree's node cache
+ */
+static
+void keepnode(const node *np)
+{
+  btree *bt = np->bt;
+  node *slot;
+  int i;
+
+  if (bt->ncache == 0)
+    {
+      bt->ncache = ALLOC(node, HFS_NCACHESZ);
+      if (bt->ncache == 0)
+	return;
+
+      for (i = 0; i < HFS_NCACHESZ; ++i)
+	bt->ncache[i].bt = 0;
+    }
+
+  slot = &bt->ncache[np->nnum % HFS_NCACHESZ];
+
+  /* leaves are visited once per search; don't let them evict index nodes */
+
+  if (slot->bt && slot->nnum != np->nnum &&
+      np->nd.ndType == ndLeafNode && slot->nd.ndType != ndLeafNode)
+    return;
+
+  memcpy(slot, np, sizeof(node));
+}
+
+/*
+ * NAME:	dropnode()
+ * DESCRIPTION:	forget any cached copy of a numbered node
+ */
+static
+void dropnode(btree *bt, unsigned long nnum)
+{
+  node *slot;
+
+  if (bt->ncache == 0)
+    return;
+
+  slot = &bt->ncache[nnum % HFS_NCACHESZ];
+  if (slot->nnum == nnum)
+    slot->bt = 0;
+}
+
+/*
+ * NAME:	btree->freecache()
+ * DESCRIPTION:	release a B*-tree's node cache
+ */
+void bt_freecache(btree *bt)
+{
+  FREE(bt->ncache);
+
+  bt->ncache = 0;
+}
 
 /*
  * NAME:	btree->getnode()
@@ -42,6 +103,7 @@ int bt_getnode(node *np, btree *bt, unsigned long nnum)
 {
   block *bp = &np->data;
   const byte *ptr;
+  const node *slot;
   int i;
 
   np->bt   = bt;
@@ -52,6 +114,10 @@ int bt_getnode(node *np, btree *bt, unsigned long nnum)
 	  bt->f.vol->mdb.drVN, bt->f.name, np->nnum);
 # endif
 
+  /* the cache and the tree file's extent state are shared by readers */
+
+  LOCK(bt->lock);
+
   /* verify the node exists and is marked as in-use */
 
   if (nnum > 0 && nnum >= bt->hdr.bthNNodes)
@@ -59,6 +125,22 @@ int bt_getnode(node *np, btree *bt, unsigned long nnum)
   else if (bt->map && ! BMTST(bt->map, nnum))
     ERROR(EIO, "read unallocated b*-tree node");
 
+  /* index nodes are usually found already parsed */
+
+  if (bt->ncache)
+    {
+      slot = &bt->ncache[nnum % HFS_NCACHESZ];
+      if (slot->bt == bt && slot->nnum == nnum)
+	{
+	  memcpy(np, slot, sizeof(node));
+	  ++bt->nhits;
+
+	  goto done;
+	}
+    }
+
+  ++bt->nmisses;
+
   if (f_getblock(&bt->f, nnum, bp) == -1)
     goto fail;
 
@@ -81,9 +163,16 @@ int bt_getnode(node *np, btree *bt, unsigned long nnum)
   while (i--)
     d_fetchuw(&ptr, &np->roff[i]);
 
+  keepnode(np);
+
+done:
+  UNLOCK(bt->lock);
+
   return 0;
 
 fail:
+  UNLOCK(bt->lock);
+
   return -1;
 }
 
@@ -129,7 +218,20 @@ int bt_putnode(node *np)
   while (i--)
     d_storeuw(&ptr, np->roff[i]);
 
-  return f_putblock(&bt->f, np->nnum, bp);
+  LOCK(bt->lock);
+
+  if (f_putblock(&bt->f, np->nnum, bp) == -1)
+    {
+      dropnode(bt, np->nnum);
+      UNLOCK(bt->lock);
+      goto fail;
+    }
+
+  keepnode(np);
+
+  UNLOCK(bt->lock);
+
+  return 0;
 
 fail:
   return -1;
@@ -645,56 +747,55 @@ fail:
   return -1;
 }
 
-/*
- * NAME:	btree->search()
- * DESCRIPTION:	locate a data record given a search key
- */
-int bt_search(btree *bt, const byte *key, node *np)
-{
-  int found = 0;
-  unsigned long nnum;
+# define NSEARCH			n_search
+# define BTSEARCH			bt_search
 
-  nnum = bt->hdr.bthRoot;
+# include "search.h"
 
-  if (nnum == 0)
-    ERROR(ENOENT, 0);
+/* specialized searches with direct key comparisons */
 
-  while (1)
-    {
-      const byte *rec;
+# define NSEARCH			n_searchcat
+# define BTSEARCH			bt_searchcat
+# define KEYCOMPARE(np, rec, key)	r_comparecatpkeys((rec), (key))
+# define NSEARCH_SCOPE			static
 
-      if (bt_getnode(np, bt, nnum) == -1)
-	{
-	  found = -1;
-	  goto fail;
-	}
+# include "search.h"
 
-      found = n_search(np, key);
+# define NSEARCH			n_searchext
+# define BTSEARCH			bt_searchext
+# define KEYCOMPARE(np, rec, key)	r_compareextpkeys((rec), (key))
+# define NSEARCH_SCOPE			static
 
-      switch (np->nd.ndType)
-	{
-	case ndIndxNode:
-	  if (np->rnum == -1)
-	    ERROR(ENOENT, 0);
+# include "search.h"
 
-	  rec  = HFS_NODEREC(*np, np->rnum);
-	  nnum = d_getul(HFS_RECDATA(rec));
-
-	  break;
+/*
+ * NAME:	btree->walk()
+ * DESCRIPTION:	call a function for every leaf record in key order
+ */
+int bt_walk(btree *bt, btwalkfunc func, void *arg)
+{
+  node n;
+  unsigned long nnum, count = 0;
+  int result;
 
-	case ndLeafNode:
-	  if (! found)
-	    ERROR(ENOENT, 0);
+  for (nnum = bt->hdr.bthFNode; nnum > 0; nnum = n.nd.ndFLink)
+    {
+      if (++count > bt->hdr.bthNNodes)
+	ERROR(EIO, "b*-tree leaf chain loops");
 
-	  goto done;
+      if (bt_getnode(&n, bt, nnum) == -1)
+	goto fail;
 
-	default:
-	  found = -1;
-	  ERROR(EIO, "unexpected b*-tree node");
+      for (n.rnum = 0; n.rnum < n.nd.ndNRecs; ++n.rnum)
+	{
+	  result = func(HFS_NODEREC(n, n.rnum), arg);
+	  if (result)
+	    return result;
 	}
     }
 
-done:
+  return 0;
+
 fail:
-  return found;
+  return -1;
 }
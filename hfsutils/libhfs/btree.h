@@ -19,6 +19,8 @@
  * $Id: btree.h,v 1.8 1998/11/02 22:08:55 rob Exp $
  */
 
+void bt_freecache(btree *);
+
 int bt_getnode(node *, btree *, unsigned long);
 int bt_putnode(node *);
 
@@ -30,4 +32,10 @@ int bt_space(btree *, unsigned int);
 int bt_insert(btree *, const byte *, unsigned int);
 int bt_delete(btree *, const byte *);
 
+typedef int (*btwalkfunc)(const byte *, void *);
+
+int bt_walk(btree *, btwalkfunc, void *);
+
 int bt_search(btree *, const byte *, node *);
+int bt_searchcat(btree *, const byte *, node *);
+int bt_searchext(btree *, const byte *, node *);
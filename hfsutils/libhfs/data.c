@@ -30,6 +30,10 @@
 #  include <sys/time.h>
 # endif
 
+# ifdef ENABLE_THREADS
+#  include <pthread.h>
+# endif
+
 # include "data.h"
 
 # define TIMEDIFF  2082844800UL
@@ -425,6 +429,40 @@ int d_relstring(const char *str1, const char *str2)
   return 0;
 }
 
+/*
+ * NAME:	data->relpstring()
+ * DESCRIPTION:	compare two counted strings as per MacOS for HFS
+ */
+int d_relpstring(const unsigned char *str1, unsigned int len1,
+		 const unsigned char *str2, unsigned int len2)
+{
+  register int diff;
+  int end1, end2;
+
+  while (len1 && len2 && *str1 && *str2)
+    {
+      diff = hfs_charorder[*str1] - hfs_charorder[*str2];
+
+      if (diff)
+	return diff;
+
+      ++str1, ++str2;
+      --len1, --len2;
+    }
+
+  /* as with d_relstring(), a NUL byte also ends a string */
+
+  end1 = (len1 == 0 || ! *str1);
+  end2 = (len2 == 0 || ! *str2);
+
+  if (end1 && ! end2)
+    return -1;
+  else if (! end1 && end2)
+    return 1;
+
+  return 0;
+}
+
 /*
  * NAME:	calctzdiff()
  * DESCRIPTION:	calculate the timezone difference between local time and UTC
@@ -461,15 +499,31 @@ void calctzdiff(void)
 }
 
 /*
- * NAME:	data->ltime()
- * DESCRIPTION:	convert MacOS time to local time
+ * NAME:	gettzdiff()
+ * DESCRIPTION:	return the timezone difference, calculating it once
  */
-time_t d_ltime(unsigned long mtime)
+static
+time_t gettzdiff(void)
 {
+# ifdef ENABLE_THREADS
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+  pthread_once(&once, calctzdiff);
+# else
   if (tzdiff == -1)
     calctzdiff();
+# endif
+
+  return tzdiff;
+}
 
-  return (time_t) (mtime - TIMEDIFF) - tzdiff;
+/*
+ * NAME:	data->ltime()
+ * DESCRIPTION:	convert MacOS time to local time
+ */
+time_t d_ltime(unsigned long mtime)
+{
+  return (time_t) (mtime - TIMEDIFF) - gettzdiff();
 }
 
 /*
@@ -478,8 +532,5 @@ time_t d_ltime(unsigned long mtime)
  */
 unsigned long d_mtime(time_t ltime)
 {
-  if (tzdiff == -1)
-    calctzdiff();
-
-  return (unsigned long) (ltime + tzdiff) + TIMEDIFF;
+  return (unsigned long) (ltime + gettzdiff()) + TIMEDIFF;
 }
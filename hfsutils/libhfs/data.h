@@ -53,6 +53,8 @@ void d_fetchstr(const unsigned char **, char *, unsigned);
 void d_storestr(unsigned char **, const char *, unsigned);
 
 int d_relstring(const char *, const char *);
+int d_relpstring(const unsigned char *, unsigned int,
+		 const unsigned char *, unsigned int);
 
 time_t d_ltime(unsigned long);
 unsigned long d_mtime(time_t);
@@ -23,6 +23,7 @@
 #  include "config.h"
 # endif
 
+# include <stdlib.h>
 # include <string.h>
 # include <errno.h>
 
@@ -31,6 +32,7 @@
 # include "btree.h"
 # include "record.h"
 # include "volume.h"
+# include "block.h"
 
 /*
  * NAME:	file->init()
@@ -88,6 +90,8 @@ void f_init(hfsfile *file, hfsvol *vol, long cnid, const char *name)
 
   file->cat.u.fil.filResrv   = 0;
 
+  file->xmap = 0;
+
   f_selectfork(file, fkData);
 
   file->flags = 0;
@@ -102,6 +106,8 @@ void f_init(hfsfile *file, hfsvol *vol, long cnid, const char *name)
  */
 void f_selectfork(hfsfile *file, int fork)
 {
+  f_freemap(file);
+
   file->fork = fork;
 
   memcpy(&file->ext, fork == fkData ?
@@ -112,6 +118,20 @@ void f_selectfork(hfsfile *file, int fork)
   file->pos  = 0;
 }
 
+/*
+ * NAME:	file->freemap()
+ * DESCRIPTION:	discard a file's extent map
+ */
+void f_freemap(hfsfile *file)
+{
+  FREE(file->xmap);
+
+  file->xmap    = 0;
+  file->xmaplen = 0;
+  file->xmapsz  = 0;
+  file->xmapend = 0;
+}
+
 /*
  * NAME:	file->getptrs()
  * DESCRIPTION:	make pointers to the current fork's lengths and extents
@@ -140,57 +160,231 @@ void f_getptrs(hfsfile *file, ExtDataRec **extrec,
 }
 
 /*
- * NAME:	file->doblock()
- * DESCRIPTION:	read or write a numbered block from a file
+ * NAME:	addmap()
+ * DESCRIPTION:	append an extent to the end of a file's extent map
  */
-int f_doblock(hfsfile *file, unsigned long num, block *bp,
-	      int (*func)(hfsvol *, unsigned int, unsigned int, block *))
+static
+int addmap(hfsfile *file, const ExtDescriptor *ext)
 {
-  unsigned int abnum;
-  unsigned int blnum;
-  unsigned int fabn;
-  int i;
+  fextent *last;
 
-  abnum = num / file->vol->lpa;
-  blnum = num % file->vol->lpa;
+  if (ext->xdrNumABlks == 0)
+    goto done;
 
-  /* locate the appropriate extent record */
+  last = file->xmaplen ? &file->xmap[file->xmaplen - 1] : 0;
 
-  fabn = file->fabn;
+  if (last && last->stabn + last->count == ext->xdrStABN)
+    last->count += ext->xdrNumABlks;
+  else
+    {
+      if (file->xmaplen == file->xmapsz)
+	{
+	  fextent *newmap;
+
+	  newmap = REALLOC(file->xmap, fextent, file->xmapsz * 2);
+	  if (newmap == 0)
+	    ERROR(ENOMEM, 0);
+
+	  file->xmap    = newmap;
+	  file->xmapsz *= 2;
+	}
+
+      last = &file->xmap[file->xmaplen++];
+
+      last->fabn  = file->xmapend;
+      last->stabn = ext->xdrStABN;
+      last->count = ext->xdrNumABlks;
+    }
+
+  file->xmapend += ext->xdrNumABlks;
+
+done:
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	extendmap()
+ * DESCRIPTION:	read extent records until a file's map covers a block
+ */
+static
+int extendmap(hfsfile *file, unsigned int abnum)
+{
+  ExtDataRec *extrec, rec;
+  unsigned int end;
+  int i;
 
-  if (abnum < fabn)
+  if (file->xmap == 0)
     {
-      ExtDataRec *extrec;
+      file->xmap = ALLOC(fextent, HFS_XMAPSZ);
+      if (file->xmap == 0)
+	ERROR(ENOMEM, 0);
+
+      file->xmapsz = HFS_XMAPSZ;
 
       f_getptrs(file, &extrec, 0, 0);
 
-      fabn = file->fabn = 0;
-      memcpy(&file->ext, extrec, sizeof(ExtDataRec));
+      for (i = 0; i < 3; ++i)
+	{
+	  if (addmap(file, &(*extrec)[i]) == -1)
+	    goto fail;
+	}
     }
-  else
-    abnum -= fabn;
 
-  while (1)
+  while (abnum >= file->xmapend)
     {
-      unsigned int n;
+      end = file->xmapend;
+
+      /* the extents file can't be extended from within itself */
+
+      if (file == &file->vol->ext.f)
+	ERROR(EIO, "extents overflow file is missing extents");
+
+      if (v_extsearch(file, end, &rec, 0) <= 0)
+	goto fail;
 
       for (i = 0; i < 3; ++i)
 	{
-	  n = file->ext[i].xdrNumABlks;
+	  if (addmap(file, &rec[i]) == -1)
+	    goto fail;
+	}
 
-	  if (abnum < n)
-	    return func(file->vol, file->ext[i].xdrStABN + abnum, blnum, bp);
+      if (file->xmapend == end)
+	ERROR(EIO, "empty file extent");
+    }
 
-	  fabn  += n;
-	  abnum -= n;
-	}
+  return 0;
 
-      if (v_extsearch(file, fabn, &file->ext, 0) <= 0)
-	goto fail;
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	locate()
+ * DESCRIPTION:	find the extent holding a file's allocation block
+ */
+static
+int locate(hfsfile *file, unsigned int abnum,
+	   unsigned int *anum, unsigned int *count)
+{
+  const fextent *ext;
+  unsigned int lo, hi, mid;
+
+  if ((file->xmap == 0 || abnum >= file->xmapend) &&
+      extendmap(file, abnum) == -1)
+    goto fail;
 
-      file->fabn = fabn;
+  /* binary search for the last extent starting at or before abnum */
+
+  for (lo = 0, hi = file->xmaplen; hi - lo > 1; )
+    {
+      mid = (lo + hi) >> 1;
+
+      if (file->xmap[mid].fabn <= abnum)
+	lo = mid;
+      else
+	hi = mid;
     }
 
+  ext = &file->xmap[lo];
+
+  *anum  = ext->stabn + (abnum - ext->fabn);
+  *count = ext->count - (abnum - ext->fabn);
+
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	file->loadmap()
+ * DESCRIPTION:	extend a file's extent map over the whole of its fork
+ */
+int f_loadmap(hfsfile *file)
+{
+  unsigned long *pylen;
+  unsigned int nblocks;
+
+  f_getptrs(file, 0, 0, &pylen);
+
+  nblocks = *pylen / file->vol->mdb.drAlBlkSiz;
+
+  if (nblocks > 0 &&
+      (file->xmap == 0 || file->xmapend < nblocks) &&
+      extendmap(file, nblocks - 1) == -1)
+    goto fail;
+
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	file->doblock()
+ * DESCRIPTION:	read or write a numbered block from a file
+ */
+int f_doblock(hfsfile *file, unsigned long num, block *bp,
+	      int (*func)(hfsvol *, unsigned int, unsigned int, block *))
+{
+  unsigned int anum, count;
+
+  if (locate(file, num / file->vol->lpa, &anum, &count) == -1)
+    goto fail;
+
+  return func(file->vol, anum, num % file->vol->lpa, bp);
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	file->mapblock()
+ * DESCRIPTION:	locate a numbered block of a file in a mapped volume
+ */
+int f_mapblock(hfsfile *file, unsigned long num, const block **bpp)
+{
+  unsigned int anum, count;
+
+  if (locate(file, num / file->vol->lpa, &anum, &count) == -1)
+    goto fail;
+
+  return b_mapab(file->vol, anum, num % file->vol->lpa, bpp);
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	file->getblocks()
+ * DESCRIPTION:	read up to len consecutive blocks from a file in one transfer
+ */
+unsigned long f_getblocks(hfsfile *file, unsigned long num, block *bp,
+			  unsigned long len)
+{
+  hfsvol *vol = file->vol;
+  unsigned int anum, count, index;
+  unsigned long run;
+
+  if (locate(file, num / vol->lpa, &anum, &count) == -1)
+    goto fail;
+
+  /* stop at the end of the extent */
+
+  index = num % vol->lpa;
+  run   = (unsigned long) count * vol->lpa - index;
+
+  if (len > run)
+    len = run;
+
+  if (b_readabn(vol, anum, index, bp, len) == -1)
+    goto fail;
+
+  return len;
+
 fail:
   return -1;
 }
@@ -294,6 +488,12 @@ int f_addextent(hfsfile *file, ExtDescriptor *blocks)
 	memcpy(extrec, &file->ext, sizeof(ExtDataRec));
     }
 
+  /* keep a complete extent map in step; otherwise rebuild it later */
+
+  if (file->xmap &&
+      (file->xmapend != end || addmap(file, blocks) == -1))
+    f_freemap(file);
+
   *pylen += blocks->xdrNumABlks * vol->mdb.drAlBlkSiz;
 
   file->flags |= HFS_FILE_UPDATE_CATREC;
@@ -368,6 +568,8 @@ int f_trunc(hfsfile *file)
   else if (newpylen == *pylen)
     goto done;
 
+  f_freemap(file);
+
   dlen  = (*pylen - newpylen) / alblksz;
 
   start = file->fabn;
@@ -26,11 +26,16 @@ enum {
 
 void f_init(hfsfile *, hfsvol *, long, const char *);
 void f_selectfork(hfsfile *, int);
+void f_freemap(hfsfile *);
+int f_loadmap(hfsfile *);
 void f_getptrs(hfsfile *, ExtDataRec **, unsigned long **, unsigned long **);
 
 int f_doblock(hfsfile *, unsigned long, block *,
 	      int (*)(hfsvol *, unsigned int, unsigned int, block *));
 
+int f_mapblock(hfsfile *, unsigned long, const block **);
+unsigned long f_getblocks(hfsfile *, unsigned long, block *, unsigned long);
+
 # define f_getblock(file, num, bp)  \
     f_doblock((file), (num), (bp), b_readab)
 # define f_putblock(file, num, bp)  \
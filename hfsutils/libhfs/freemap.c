@@ -0,0 +1,811 @@
+/*
+ * libhfs - library for reading and writing Macintosh HFS volumes
+ * Copyright (C) 1996-1998 Robert Leslie
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * $Id$
+ */
+
+# ifdef HAVE_CONFIG_H
+#  include "config.h"
+# endif
+
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+
+# include "libhfs.h"
+# include "freemap.h"
+# include "bitmap.h"
+
+/*
+ * The free map indexes the runs of clear bits in the volume bitmap. Each
+ * run is linked into two treaps sharing one priority: one ordered by
+ * starting block, where every node also records the largest run beneath
+ * it, and one ordered by length. The first answers "the first run of at
+ * least n blocks at or after block p" and the second "the smallest run of
+ * at least n blocks", both in logarithmic time.
+ *
+ * The bitmap remains authoritative. Anything that changes it other than
+ * v_allocblocks() and v_freeblocks() must discard the map with fm_free();
+ * it is rebuilt on the next allocation.
+ *
+ * Allocations found by searching near the allocation pointer, and blocks
+ * freed close to them, need not update the treaps at once. The map keeps
+ * one short span of bitmap bytes that may have changed, with a copy of
+ * them as last indexed, and reindexes it only before the treaps are next
+ * consulted; a span changed and changed back costs nothing.
+ */
+
+/*
+ * NAME:	prio()
+ * DESCRIPTION:	return a treap priority for a run
+ */
+static
+unsigned int prio(unsigned int start)
+{
+  unsigned long h = start & 0xffffffffUL;
+
+  /* MurmurHash3 finalizer; every input bit affects every output bit */
+
+  h ^= h >> 16;
+  h  = (h * 0x85ebca6bUL) & 0xffffffffUL;
+  h ^= h >> 13;
+  h  = (h * 0xc2b2ae35UL) & 0xffffffffUL;
+  h ^= h >> 16;
+
+  return (unsigned int) h;
+}
+
+/*
+ * NAME:	fixmax()
+ * DESCRIPTION:	recompute the largest run below an address-ordered node
+ */
+static
+void fixmax(frun *t)
+{
+  t->maxcount = t->count;
+
+  if (t->alo && t->alo->maxcount > t->maxcount)
+    t->maxcount = t->alo->maxcount;
+  if (t->ahi && t->ahi->maxcount > t->maxcount)
+    t->maxcount = t->ahi->maxcount;
+}
+
+/*
+ * NAME:	asplit()
+ * DESCRIPTION:	split an address treap into runs before and from a block
+ */
+static
+void asplit(frun *t, unsigned int start, frun **lo, frun **hi)
+{
+  if (t == 0)
+    *lo = *hi = 0;
+  else if (t->start < start)
+    {
+      asplit(t->ahi, start, &t->ahi, hi);
+      fixmax(t);
+      *lo = t;
+    }
+  else
+    {
+      asplit(t->alo, start, lo, &t->alo);
+      fixmax(t);
+      *hi = t;
+    }
+}
+
+/*
+ * NAME:	ajoin()
+ * DESCRIPTION:	join two address treaps, all of lo preceding all of hi
+ */
+static
+frun *ajoin(frun *lo, frun *hi)
+{
+  if (lo == 0)
+    return hi;
+  if (hi == 0)
+    return lo;
+
+  if (lo->prio > hi->prio)
+    {
+      lo->ahi = ajoin(lo->ahi, hi);
+      fixmax(lo);
+      return lo;
+    }
+  else
+    {
+      hi->alo = ajoin(lo, hi->alo);
+      fixmax(hi);
+      return hi;
+    }
+}
+
+/*
+ * NAME:	sless()
+ * DESCRIPTION:	return true if a run sorts before (count, start) by size
+ */
+static
+int sless(const frun *t, unsigned int count, unsigned int start)
+{
+  return t->count < count || (t->count == count && t->start < start);
+}
+
+/*
+ * NAME:	ssplit()
+ * DESCRIPTION:	split a size treap into runs before and from (count, start)
+ */
+static
+void ssplit(frun *t, unsigned int count, unsigned int start,
+	    frun **lo, frun **hi)
+{
+  if (t == 0)
+    *lo = *hi = 0;
+  else if (sless(t, count, start))
+    {
+      ssplit(t->shi, count, start, &t->shi, hi);
+      *lo = t;
+    }
+  else
+    {
+      ssplit(t->slo, count, start, lo, &t->slo);
+      *hi = t;
+    }
+}
+
+/*
+ * NAME:	sjoin()
+ * DESCRIPTION:	join two size treaps, all of lo preceding all of hi
+ */
+static
+frun *sjoin(frun *lo, frun *hi)
+{
+  if (lo == 0)
+    return hi;
+  if (hi == 0)
+    return lo;
+
+  if (lo->prio > hi->prio)
+    {
+      lo->shi = sjoin(lo->shi, hi);
+      return lo;
+    }
+  else
+    {
+      hi->slo = sjoin(lo, hi->slo);
+      return hi;
+    }
+}
+
+/*
+ * NAME:	ainsert()
+ * DESCRIPTION:	insert a run into an address treap; return the new root
+ */
+static
+frun *ainsert(frun *t, frun *run)
+{
+  if (t == 0)
+    return run;
+
+  if (run->prio > t->prio)
+    {
+      asplit(t, run->start, &run->alo, &run->ahi);
+      fixmax(run);
+      return run;
+    }
+
+  if (run->start < t->start)
+    t->alo = ainsert(t->alo, run);
+  else
+    t->ahi = ainsert(t->ahi, run);
+
+  fixmax(t);
+
+  return t;
+}
+
+/*
+ * NAME:	aremove()
+ * DESCRIPTION:	remove a run from an address treap; return the new root
+ */
+static
+frun *aremove(frun *t, const frun *run)
+{
+  if (t == run)
+    return ajoin(t->alo, t->ahi);
+
+  if (run->start < t->start)
+    t->alo = aremove(t->alo, run);
+  else
+    t->ahi = aremove(t->ahi, run);
+
+  fixmax(t);
+
+  return t;
+}
+
+/*
+ * NAME:	arefresh()
+ * DESCRIPTION:	recompute largest runs on the path to a resized run
+ */
+static
+void arefresh(frun *t, unsigned int start)
+{
+  if (t->start != start)
+    arefresh(start < t->start ? t->alo : t->ahi, start);
+
+  fixmax(t);
+}
+
+/*
+ * NAME:	sinsert()
+ * DESCRIPTION:	insert a run into a size treap; return the new root
+ */
+static
+frun *sinsert(frun *t, frun *run)
+{
+  if (t == 0)
+    return run;
+
+  if (run->prio > t->prio)
+    {
+      ssplit(t, run->count, run->start, &run->slo, &run->shi);
+      return run;
+    }
+
+  if (sless(run, t->count, t->start))
+    t->slo = sinsert(t->slo, run);
+  else
+    t->shi = sinsert(t->shi, run);
+
+  return t;
+}
+
+/*
+ * NAME:	sremove()
+ * DESCRIPTION:	remove a run from a size treap; return the new root
+ */
+static
+frun *sremove(frun *t, const frun *run)
+{
+  if (t == run)
+    return sjoin(t->slo, t->shi);
+
+  if (sless(run, t->count, t->start))
+    t->slo = sremove(t->slo, run);
+  else
+    t->shi = sremove(t->shi, run);
+
+  return t;
+}
+
+/*
+ * NAME:	attach()
+ * DESCRIPTION:	link a new run into both treaps
+ */
+static
+void attach(fmap *fm, frun *run)
+{
+  run->prio = prio(run->start);
+  run->alo  = run->ahi = 0;
+  run->slo  = run->shi = 0;
+
+  fixmax(run);
+
+  fm->byaddr = ainsert(fm->byaddr, run);
+  fm->bysize = sinsert(fm->bysize, run);
+
+  ++fm->nruns;
+}
+
+/*
+ * NAME:	detach()
+ * DESCRIPTION:	unlink a run from both treaps
+ */
+static
+void detach(fmap *fm, frun *run)
+{
+  fm->byaddr = aremove(fm->byaddr, run);
+  fm->bysize = sremove(fm->bysize, run);
+
+  --fm->nruns;
+}
+
+/*
+ * NAME:	resize()
+ * DESCRIPTION:	change the extent of a run without reordering it by address
+ */
+static
+void resize(fmap *fm, frun *run, unsigned int start, unsigned int count)
+{
+  fm->bysize = sremove(fm->bysize, run);
+
+  run->start = start;
+  run->count = count;
+  run->slo   = run->shi = 0;
+
+  arefresh(fm->byaddr, start);
+  fm->bysize = sinsert(fm->bysize, run);
+}
+
+/*
+ * NAME:	floorrun()
+ * DESCRIPTION:	return the last run starting at or before a block (or 0)
+ */
+static
+frun *floorrun(frun *t, unsigned int pt)
+{
+  frun *found = 0;
+
+  while (t)
+    {
+      if (t->start <= pt)
+	found = t, t = t->ahi;
+      else
+	t = t->alo;
+    }
+
+  return found;
+}
+
+/*
+ * NAME:	ceilrun()
+ * DESCRIPTION:	return the first run starting at or after a block (or 0)
+ */
+static
+frun *ceilrun(frun *t, unsigned int pt)
+{
+  frun *found = 0;
+
+  while (t)
+    {
+      if (t->start >= pt)
+	found = t, t = t->alo;
+      else
+	t = t->ahi;
+    }
+
+  return found;
+}
+
+/*
+ * NAME:	firstfit()
+ * DESCRIPTION:	return the first run of at least count blocks from a block
+ */
+static
+frun *firstfit(frun *t, unsigned int pt, unsigned int count)
+{
+  frun *found;
+
+  if (t == 0 || t->maxcount < count)
+    return 0;
+
+  if (t->start < pt)
+    return firstfit(t->ahi, pt, count);
+
+  found = firstfit(t->alo, pt, count);
+  if (found)
+    return found;
+
+  if (t->count >= count)
+    return t;
+
+  return firstfit(t->ahi, pt, count);
+}
+
+/*
+ * NAME:	bestfit()
+ * DESCRIPTION:	return the smallest run of at least count blocks (or 0)
+ */
+static
+frun *bestfit(frun *t, unsigned int count)
+{
+  frun *found = 0;
+
+  while (t)
+    {
+      if (t->count >= count)
+	found = t, t = t->slo;
+      else
+	t = t->shi;
+    }
+
+  return found;
+}
+
+/*
+ * NAME:	freetree()
+ * DESCRIPTION:	dispose of all runs in an address treap
+ */
+static
+void freetree(frun *t)
+{
+  while (t)
+    {
+      frun *next = t->ahi;
+
+      freetree(t->alo);
+      FREE(t);
+
+      t = next;
+    }
+}
+
+/*
+ * NAME:	defer()
+ * DESCRIPTION:	add blocks about to change to the span awaiting reindexing
+ *
+ * Returns 1 if the blocks were added, or 0 if the span would grow too
+ * large; the caller then reindexes the span and tries again.
+ */
+static
+int defer(hfsvol *vol, unsigned int start, unsigned int count)
+{
+  fmap *fm = vol->fmap;
+  const byte *vbm = (const byte *) vol->vbm;
+  unsigned int lo, hi;
+
+  lo = start >> 3;
+  hi = ((start + count - 1) >> 3) + 1;
+
+  if (fm->dlo == fm->dhi)
+    {
+      if (hi - lo > HFS_FMSAVESZ)
+	return 0;
+
+      memcpy(fm->saved, vbm + lo, hi - lo);
+    }
+  else
+    {
+      if (lo > fm->dlo)
+	lo = fm->dlo;
+      if (hi < fm->dhi)
+	hi = fm->dhi;
+
+      if (hi - lo > HFS_FMSAVESZ)
+	return 0;
+
+      /* bytes outside the span are still as indexed */
+
+      memmove(fm->saved + (fm->dlo - lo), fm->saved, fm->dhi - fm->dlo);
+      memcpy(fm->saved, vbm + lo, fm->dlo - lo);
+      memcpy(fm->saved + (fm->dhi - lo), vbm + fm->dhi, hi - fm->dhi);
+    }
+
+  fm->dlo = lo;
+  fm->dhi = hi;
+
+  return 1;
+}
+
+/*
+ * NAME:	freemap->sync()
+ * DESCRIPTION:	reindex the span of the bitmap changed since last indexed
+ */
+int fm_sync(hfsvol *vol)
+{
+  fmap *fm = vol->fmap;
+  const byte *vbm = (const byte *) vol->vbm;
+  unsigned int start, end, pt, mark, nblocks = vol->mdb.drNmAlBlks;
+  frun *run;
+
+  if (fm == 0 || fm->dlo == fm->dhi)
+    goto done;
+
+  start = fm->dlo << 3;
+  end   = fm->dhi << 3;
+
+  if (end > nblocks)
+    end = nblocks;
+
+  if (memcmp(fm->saved, vbm + fm->dlo, fm->dhi - fm->dlo) == 0)
+    {
+      fm->dlo = fm->dhi = 0;
+      goto done;
+    }
+
+  fm->dlo = fm->dhi = 0;
+
+  /* drop the runs within or touching the span, then index it afresh */
+
+  for (run = floorrun(fm->byaddr, end);
+       run && run->start + run->count >= start;
+       run = floorrun(fm->byaddr, end))
+    {
+      if (run->start < start)
+	start = run->start;
+      if (run->start + run->count > end)
+	end = run->start + run->count;
+
+      detach(fm, run);
+      FREE(run);
+    }
+
+  for (pt = bm_findclr(vbm, start, end); pt < end;
+       pt = bm_findclr(vbm, pt, end))
+    {
+      mark = pt;
+      pt   = bm_findset(vbm, pt, end);
+
+      run = ALLOC(frun, 1);
+      if (run == 0)
+	{
+	  fm_free(vol);
+	  ERROR(ENOMEM, 0);
+	}
+
+      run->start = mark;
+      run->count = pt - mark;
+
+      attach(fm, run);
+    }
+
+done:
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	freemap->build()
+ * DESCRIPTION:	index the free runs of a volume's bitmap
+ */
+int fm_build(hfsvol *vol)
+{
+  const byte *vbm = (const byte *) vol->vbm;
+  unsigned int pt, end, mark;
+  fmap *fm;
+
+  ASSERT(vol->fmap == 0);
+
+  fm = vol->fmap = ALLOC(fmap, 1);
+  if (fm == 0)
+    ERROR(ENOMEM, 0);
+
+  fm->byaddr = 0;
+  fm->bysize = 0;
+  fm->nruns  = 0;
+
+  fm->dlo    = 0;
+  fm->dhi    = 0;
+
+  end = vol->mdb.drNmAlBlks;
+
+  for (pt = bm_findclr(vbm, 0, end); pt < end; pt = bm_findclr(vbm, pt, end))
+    {
+      frun *run;
+
+      mark = pt;
+      pt   = bm_findset(vbm, pt, end);
+
+      run = ALLOC(frun, 1);
+      if (run == 0)
+	ERROR(ENOMEM, 0);
+
+      run->start = mark;
+      run->count = pt - mark;
+
+      attach(fm, run);
+    }
+
+  return 0;
+
+fail:
+  fm_free(vol);
+  return -1;
+}
+
+/*
+ * NAME:	freemap->free()
+ * DESCRIPTION:	discard a volume's free map
+ */
+void fm_free(hfsvol *vol)
+{
+  if (vol->fmap == 0)
+    return;
+
+  freetree(vol->fmap->byaddr);
+  FREE(vol->fmap);
+
+  vol->fmap = 0;
+}
+
+/*
+ * NAME:	freemap->take()
+ * DESCRIPTION:	remove up to request blocks from the map; return count
+ */
+unsigned int fm_take(hfsvol *vol, unsigned int pt, unsigned int request,
+		     int best, unsigned int *foundat)
+{
+  fmap *fm = vol->fmap;
+  frun *run;
+  unsigned int found;
+
+  ASSERT(fm->dlo == fm->dhi);
+
+  if (fm->byaddr == 0)
+    return 0;
+
+  /* settle for the largest run if none is big enough */
+
+  if (request > fm->byaddr->maxcount)
+    request = fm->byaddr->maxcount;
+
+  if (best)
+    run = bestfit(fm->bysize, request);
+  else
+    {
+      /* begin with the run containing pt, wrapping to block 0 */
+
+      run = floorrun(fm->byaddr, pt);
+      if (run && pt < run->start + run->count)
+	pt = run->start;
+
+      run = firstfit(fm->byaddr, pt, request);
+      if (run == 0)
+	run = firstfit(fm->byaddr, 0, request);
+    }
+
+  if (run == 0)
+    return 0;
+
+  found    = request;
+  *foundat = run->start;
+
+  if (run->count > found)
+    resize(fm, run, run->start + found, run->count - found);
+  else
+    {
+      detach(fm, run);
+      FREE(run);
+    }
+
+  return found;
+}
+
+/*
+ * NAME:	freemap->claim()
+ * DESCRIPTION:	remove blocks found free in the bitmap from the map
+ */
+void fm_claim(hfsvol *vol, unsigned int start, unsigned int count)
+{
+  fmap *fm = vol->fmap;
+  frun *run;
+  unsigned int end;
+
+  if (fm == 0 || count == 0 || defer(vol, start, count))
+    return;
+
+  if (fm_sync(vol) == -1 || defer(vol, start, count))
+    return;
+
+  run = floorrun(fm->byaddr, start);
+  if (run == 0 || run->start + run->count < start + count)
+    {
+      fm_free(vol);
+      return;
+    }
+
+  end = run->start + run->count;
+
+  if (run->start < start)
+    {
+      resize(fm, run, run->start, start - run->start);
+
+      if (end > start + count)
+	{
+	  run = ALLOC(frun, 1);
+	  if (run == 0)
+	    {
+	      fm_free(vol);
+	      return;
+	    }
+
+	  run->start = start + count;
+	  run->count = end - run->start;
+
+	  attach(fm, run);
+	}
+    }
+  else if (end > start + count)
+    resize(fm, run, start + count, end - start - count);
+  else
+    {
+      detach(fm, run);
+      FREE(run);
+    }
+}
+
+/*
+ * NAME:	freemap->give()
+ * DESCRIPTION:	return blocks to the map, merging with adjacent runs
+ */
+int fm_give(hfsvol *vol, unsigned int start, unsigned int count)
+{
+  fmap *fm = vol->fmap;
+  frun *prev, *next;
+
+  if (fm == 0 || count == 0)
+    goto done;
+
+  if (bm_findclr((const byte *) vol->vbm, start, start + count) !=
+      start + count)
+    {
+      fm_free(vol);
+      ERROR(EIO, "freeing blocks already free");
+    }
+
+  if (defer(vol, start, count))
+    goto done;
+
+  if (fm_sync(vol) == -1 || defer(vol, start, count))
+    goto done;
+
+  prev = start > 0 ? floorrun(fm->byaddr, start - 1) : 0;
+  next = ceilrun(fm->byaddr, start);
+
+  /* no free run may overlap the blocks being freed */
+
+  if ((prev && prev->start + prev->count > start) ||
+      (next && next->start < start + count))
+    {
+      fm_free(vol);
+      ERROR(EIO, "freeing blocks already free");
+    }
+
+  if (next && next->start > start + count)
+    next = 0;
+
+  if (prev && prev->start + prev->count == start)
+    {
+      if (next)
+	{
+	  count += next->count;
+
+	  detach(fm, next);
+	  FREE(next);
+	}
+
+      resize(fm, prev, prev->start, prev->count + count);
+    }
+  else if (next)
+    resize(fm, next, start, next->count + count);
+  else
+    {
+      frun *run;
+
+      /* without memory for the run, rebuild the map when next needed */
+
+      run = ALLOC(frun, 1);
+      if (run == 0)
+	{
+	  fm_free(vol);
+	  goto done;
+	}
+
+      run->start = start;
+      run->count = count;
+
+      attach(fm, run);
+    }
+
+done:
+  return 0;
+
+fail:
+  return -1;
+}
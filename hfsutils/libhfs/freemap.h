@@ -0,0 +1,29 @@
+/*
+ * libhfs - library for reading and writing Macintosh HFS volumes
+ * Copyright (C) 1996-1998 Robert Leslie
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * $Id$
+ */
+
+int fm_build(hfsvol *);
+void fm_free(hfsvol *);
+int fm_sync(hfsvol *);
+
+unsigned int fm_take(hfsvol *, unsigned int, unsigned int, int,
+		     unsigned int *);
+void fm_claim(hfsvol *, unsigned int, unsigned int);
+int fm_give(hfsvol *, unsigned int, unsigned int);
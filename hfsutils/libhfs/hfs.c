@@ -37,14 +37,34 @@
 # include "node.h"
 # include "record.h"
 # include "volume.h"
+# include "mem.h"
 
+# ifdef ENABLE_THREADS
+static __thread
+const char *errstr = "no error";	/* static error string (per thread) */
+# else
 const char *hfs_error = "no error";	/* static error string */
+# endif
 
 hfsvol *hfs_mounts;			/* linked list of mounted volumes */
 
 static
 hfsvol *curvol;				/* current volume */
 
+static
+hfslock mountlock = LOCKINITIALIZER;	/* guards hfs_mounts and curvol */
+
+# ifdef ENABLE_THREADS
+/*
+ * NAME:	hfs->errorp()
+ * DESCRIPTION:	return the location of the calling thread's error string
+ */
+const char **hfs_errorp(void)
+{
+  return &errstr;
+}
+# endif
+
 /*
  * NAME:	validvname()
  * DESCRIPTION:	return true if parameter is a valid volume name
@@ -79,10 +99,12 @@ int getvol(hfsvol **vol)
 {
   if (*vol == 0)
     {
-      if (curvol == 0)
-	ERROR(EINVAL, "no volume is current");
-
+      LOCK(mountlock);
       *vol = curvol;
+      UNLOCK(mountlock);
+
+      if (*vol == 0)
+	ERROR(EINVAL, "no volume is current");
     }
 
   return 0;
@@ -91,6 +113,124 @@ fail:
   return -1;
 }
 
+/*
+ * NAME:	linkdir()
+ * DESCRIPTION:	add a directory to its volume's list of open directories
+ */
+static
+void linkdir(hfsvol *vol, hfsdir *dir)
+{
+  LOCK(vol->lock);
+
+  dir->prev = 0;
+  dir->next = vol->dirs;
+
+  if (vol->dirs)
+    vol->dirs->prev = dir;
+
+  vol->dirs = dir;
+
+  UNLOCK(vol->lock);
+}
+
+/*
+ * NAME:	unlinkdir()
+ * DESCRIPTION:	remove a directory from its volume's list of open directories
+ */
+static
+void unlinkdir(hfsvol *vol, hfsdir *dir)
+{
+  LOCK(vol->lock);
+
+  if (dir->prev)
+    dir->prev->next = dir->next;
+  if (dir->next)
+    dir->next->prev = dir->prev;
+  if (dir == vol->dirs)
+    vol->dirs = dir->next;
+
+  UNLOCK(vol->lock);
+}
+
+/*
+ * NAME:	linkfile()
+ * DESCRIPTION:	add a file to its volume's list of open files
+ */
+static
+void linkfile(hfsvol *vol, hfsfile *file)
+{
+  LOCK(vol->lock);
+
+  file->prev = 0;
+  file->next = vol->files;
+
+  if (vol->files)
+    vol->files->prev = file;
+
+  vol->files = file;
+
+  UNLOCK(vol->lock);
+}
+
+/*
+ * NAME:	unlinkfile()
+ * DESCRIPTION:	remove a file from its volume's list of open files
+ */
+static
+void unlinkfile(hfsvol *vol, hfsfile *file)
+{
+  LOCK(vol->lock);
+
+  if (file->prev)
+    file->prev->next = file->next;
+  if (file->next)
+    file->next->prev = file->prev;
+  if (file == vol->files)
+    vol->files = file->next;
+
+  UNLOCK(vol->lock);
+}
+
+/*
+ * NAME:	freevol()
+ * DESCRIPTION:	dispose of a closed volume structure
+ */
+static
+void freevol(hfsvol *vol)
+{
+  LOCKFREE(vol->lock);
+  LOCKFREE(vol->dlock);
+  LOCKFREE(vol->ext.lock);
+  LOCKFREE(vol->cat.lock);
+
+  FREE(vol);
+}
+
+/*
+ * NAME:	mountvol()
+ * DESCRIPTION:	mount an opened volume and add it to the list of volumes
+ */
+static
+int mountvol(hfsvol *vol, int pnum)
+{
+  if (v_geometry(vol, pnum) == -1 ||
+      v_mount(vol) == -1)
+    goto fail;
+
+  vol->prev = 0;
+  vol->next = hfs_mounts;
+
+  if (hfs_mounts)
+    hfs_mounts->prev = vol;
+
+  hfs_mounts = vol;
+
+  return 0;
+
+fail:
+  return -1;
+}
+
 /* High-Level Volume Routines ============================================== */
 
 /*
@@ -101,6 +241,8 @@ hfsvol *hfs_mount(const char *path, int pnum, int mode)
 {
   hfsvol *vol, *check;
 
+  LOCK(mountlock);
+
   /* see if the volume is already mounted */
 
   for (check = hfs_mounts; check; check = check->next)
@@ -148,33 +290,121 @@ hfsvol *hfs_mount(const char *path, int pnum, int mode)
 
   /* mount the volume */
 
-  if (v_geometry(vol, pnum) == -1 ||
-      v_mount(vol) == -1)
+  if (mountvol(vol, pnum) == -1)
     goto fail;
 
-  /* add to linked list of volumes */
+done:
+  ++vol->refs;
+  curvol = vol;
 
-  vol->prev = 0;
-  vol->next = hfs_mounts;
+  UNLOCK(mountlock);
 
-  if (hfs_mounts)
-    hfs_mounts->prev = vol;
+  return vol;
 
-  hfs_mounts = vol;
+fail:
+  if (vol)
+    {
+      v_close(vol);
+      freevol(vol);
+    }
+
+  UNLOCK(mountlock);
+
+  return 0;
+}
+
+/*
+ * NAME:	hfs->mount_io()
+ * DESCRIPTION:	mount an HFS volume on a medium accessed through procedures
+ */
+hfsvol *hfs_mount_io(void *priv, const struct hfsioprocs *procs,
+		     int pnum, int mode)
+{
+  hfsvol *vol = 0;
+
+  if (procs->read == 0)
+    ERROR(EINVAL, "medium read procedure required");
+
+  vol = ALLOC(hfsvol, 1);
+  if (vol == 0)
+    ERROR(ENOMEM, 0);
+
+  v_init(vol, mode);
+
+  switch (mode & HFS_MODE_MASK)
+    {
+    case HFS_MODE_RDWR:
+      if (procs->write == 0)
+	ERROR(EROFS, "medium is not writable");
+      break;
+
+    case HFS_MODE_ANY:
+      if (procs->write)
+	break;
+
+      /* fall through */
+
+    case HFS_MODE_RDONLY:
+    default:
+      vol->flags |= HFS_VOL_READONLY;
+    }
+
+  if (v_openio(vol, priv, procs, (vol->flags & HFS_VOL_READONLY) ?
+	       HFS_MODE_RDONLY : HFS_MODE_RDWR) == -1)
+    goto fail;
+
+  LOCK(mountlock);
+
+  if (mountvol(vol, pnum) == -1)
+    {
+      UNLOCK(mountlock);
+      goto fail;
+    }
 
-done:
   ++vol->refs;
   curvol = vol;
 
+  UNLOCK(mountlock);
+
   return vol;
 
 fail:
   if (vol)
     {
+      /* the medium remains the caller's if the mount fails */
+
+      vol->io.close = 0;
+
       v_close(vol);
-      FREE(vol);
+      freevol(vol);
+    }
+
+  return 0;
+}
+
+/*
+ * NAME:	hfs->mount_mem()
+ * DESCRIPTION:	mount an HFS volume image held in memory
+ */
+hfsvol *hfs_mount_mem(void *buf, unsigned long len, int pnum, int mode)
+{
+  void *priv;
+  hfsvol *vol;
+
+  priv = mem_open(buf, len);
+  if (priv == 0)
+    goto fail;
+
+  vol = hfs_mount_io(priv, &mem_procs, pnum, mode);
+  if (vol == 0)
+    {
+      mem_close(priv);
+      goto fail;
     }
 
+  return vol;
+
+fail:
   return 0;
 }
 
@@ -189,12 +419,19 @@ int hfs_flush(hfsvol *vol)
   if (getvol(&vol) == -1)
     goto fail;
 
+  LOCK(vol->lock);
+
   for (file = vol->files; file; file = file->next)
     {
       if (f_flush(file) == -1)
-	goto fail;
+	{
+	  UNLOCK(vol->lock);
+	  goto fail;
+	}
     }
 
+  UNLOCK(vol->lock);
+
   if (v_flush(vol) == -1)
     goto fail;
 
@@ -212,8 +449,12 @@ void hfs_flushall(void)
 {
   hfsvol *vol;
 
+  LOCK(mountlock);
+
   for (vol = hfs_mounts; vol; vol = vol->next)
     hfs_flush(vol);
+
+  UNLOCK(mountlock);
 }
 
 /*
@@ -227,6 +468,8 @@ int hfs_umount(hfsvol *vol)
   if (getvol(&vol) == -1)
     goto fail;
 
+  LOCK(mountlock);
+
   if (--vol->refs)
     {
       result = v_flush(vol);
@@ -264,9 +507,11 @@ int hfs_umount(hfsvol *vol)
   if (vol == curvol)
     curvol = 0;
 
-  FREE(vol);
+  freevol(vol);
 
 done:
+  UNLOCK(mountlock);
+
   return result;
 
 fail:
@@ -291,16 +536,22 @@ hfsvol *hfs_getvol(const char *name)
 {
   hfsvol *vol;
 
-  if (name == 0)
-    return curvol;
+  LOCK(mountlock);
 
-  for (vol = hfs_mounts; vol; vol = vol->next)
+  if (name == 0)
+    vol = curvol;
+  else
     {
-      if (d_relstring(name, vol->mdb.drVN) == 0)
-	return vol;
+      for (vol = hfs_mounts; vol; vol = vol->next)
+	{
+	  if (d_relstring(name, vol->mdb.drVN) == 0)
+	    break;
+	}
     }
 
-  return 0;
+  UNLOCK(mountlock);
+
+  return vol;
 }
 
 /*
@@ -309,7 +560,110 @@ hfsvol *hfs_getvol(const char *name)
  */
 void hfs_setvol(hfsvol *vol)
 {
+  LOCK(mountlock);
   curvol = vol;
+  UNLOCK(mountlock);
+}
+
+/*
+ * NAME:	hfs->setcachesz()
+ * DESCRIPTION:	change the capacity (in bytes) of a volume's block cache
+ */
+int hfs_setcachesz(hfsvol *vol, unsigned long size)
+{
+  unsigned long nbuckets;
+
+  if (getvol(&vol) == -1)
+    goto fail;
+
+  /* any nonzero size keeps a cache, however small */
+
+  nbuckets = size / HFS_BLOCKSZ + (size % HFS_BLOCKSZ != 0);
+  if (nbuckets != (unsigned int) nbuckets)
+    ERROR(EINVAL, "block cache size too large");
+
+  if (b_resize(vol, nbuckets) == -1)
+    goto fail;
+
+  if (vol->cache)
+    vol->flags |= HFS_VOL_USINGCACHE;
+  else
+    vol->flags &= ~HFS_VOL_USINGCACHE;
+
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	hfs->setcachepolicy()
+ * DESCRIPTION:	select the replacement policy of a volume's block cache
+ */
+int hfs_setcachepolicy(hfsvol *vol, int policy)
+{
+  if (getvol(&vol) == -1 ||
+      b_setpolicy(vol, policy) == -1)
+    goto fail;
+
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	hfs->cachestat()
+ * DESCRIPTION:	return block cache statistics
+ */
+int hfs_cachestat(hfsvol *vol, hfscachestat *ent)
+{
+  bcache *cache;
+
+  if (getvol(&vol) == -1)
+    goto fail;
+
+  memset(ent, 0, sizeof(*ent));
+
+  LOCK(vol->cat.lock);
+  ent->cathits   = vol->cat.nhits;
+  ent->catmisses = vol->cat.nmisses;
+  UNLOCK(vol->cat.lock);
+
+  LOCK(vol->ext.lock);
+  ent->exthits   = vol->ext.nhits;
+  ent->extmisses = vol->ext.nmisses;
+  UNLOCK(vol->ext.lock);
+
+  cache = vol->cache;
+  if (cache == 0)
+    goto done;
+
+  LOCK(cache->lock);
+
+  ent->policy    = cache->policy;
+  ent->size      = (unsigned long) cache->size * HFS_BLOCKSZ;
+
+  ent->hits      = cache->hits;
+  ent->misses    = cache->misses;
+
+  ent->inhits    = cache->inhits;
+  ent->mainhits  = cache->mainhits;
+  ent->ghosthits = cache->ghosthits;
+
+  ent->rawindow  = (unsigned long) cache->rawin  * HFS_BLOCKSZ;
+  ent->rapeak    = (unsigned long) cache->rapeak * HFS_BLOCKSZ;
+  ent->rablocks  = cache->rablocks;
+  ent->rahits    = cache->rahits;
+  ent->rawasted  = cache->rawasted;
+
+  UNLOCK(cache->lock);
+
+done:
+  return 0;
+
+fail:
+  return -1;
 }
 
 /*
@@ -469,6 +823,41 @@ fail:
   return -1;
 }
 
+/*
+ * NAME:	startdir()
+ * DESCRIPTION:	position an open directory at its thread record
+ */
+static
+int startdir(hfsvol *vol, hfsdir *dir, unsigned long id)
+{
+  CatKeyRec key;
+  CatDataRec data;
+  byte pkey[HFS_CATKEYLEN];
+  int found;
+
+  dir->dirid = id;
+  dir->vptr  = 0;
+
+  r_makecatkey(&key, id, "");
+  r_packcatkey(&key, pkey, 0);
+
+  found = bt_searchcat(&vol->cat, pkey, &dir->n);
+  if (found == -1)
+    goto fail;
+  else if (! found)
+    ERROR(ENOENT, 0);
+
+  r_unpackcatdata(HFS_RECDATA(HFS_NODEREC(dir->n, dir->n.rnum)), &data);
+
+  if (data.cdrType != cdrThdRec)
+    ERROR(ENOTDIR, 0);
+
+  return 0;
+
+fail:
+  return -1;
+}
+
 /*
  * NAME:	hfs->opendir()
  * DESCRIPTION:	prepare to read the contents of a directory
@@ -476,9 +865,7 @@ fail:
 hfsdir *hfs_opendir(hfsvol *vol, const char *path)
 {
   hfsdir *dir = 0;
-  CatKeyRec key;
   CatDataRec data;
-  byte pkey[HFS_CATKEYLEN];
 
   if (getvol(&vol) == -1)
     goto fail;
@@ -493,8 +880,12 @@ hfsdir *hfs_opendir(hfsvol *vol, const char *path)
     {
       /* meta-directory containing root dirs from all mounted volumes */
 
+      LOCK(mountlock);
+
       dir->dirid = 0;
       dir->vptr  = hfs_mounts;
+
+      UNLOCK(mountlock);
     }
   else
     {
@@ -504,23 +895,40 @@ hfsdir *hfs_opendir(hfsvol *vol, const char *path)
       if (data.cdrType != cdrDirRec)
 	ERROR(ENOTDIR, 0);
 
-      dir->dirid = data.u.dir.dirDirID;
-      dir->vptr  = 0;
-
-      r_makecatkey(&key, dir->dirid, "");
-      r_packcatkey(&key, pkey, 0);
-
-      if (bt_search(&vol->cat, pkey, &dir->n) <= 0)
+      if (startdir(vol, dir, data.u.dir.dirDirID) == -1)
 	goto fail;
     }
 
-  dir->prev = 0;
-  dir->next = vol->dirs;
+  linkdir(vol, dir);
 
-  if (vol->dirs)
-    vol->dirs->prev = dir;
+  return dir;
 
-  vol->dirs = dir;
+fail:
+  FREE(dir);
+  return 0;
+}
+
+/*
+ * NAME:	hfs->opendir_id()
+ * DESCRIPTION:	prepare to read the contents of a directory given its ID
+ */
+hfsdir *hfs_opendir_id(hfsvol *vol, unsigned long id)
+{
+  hfsdir *dir = 0;
+
+  if (getvol(&vol) == -1)
+    goto fail;
+
+  dir = ALLOC(hfsdir, 1);
+  if (dir == 0)
+    ERROR(ENOMEM, 0);
+
+  dir->vol = vol;
+
+  if (startdir(vol, dir, id) == -1)
+    goto fail;
+
+  linkdir(vol, dir);
 
   return dir;
 
@@ -543,6 +951,11 @@ int hfs_readdir(hfsdir *dir, hfsdirent *ent)
     {
       hfsvol *vol;
       char cname[HFS_MAX_FLEN + 1];
+      int found;
+
+      /* the volume may not be unmounted while it is being read */
+
+      LOCK(mountlock);
 
       for (vol = hfs_mounts; vol; vol = vol->next)
 	{
@@ -550,18 +963,23 @@ int hfs_readdir(hfsdir *dir, hfsdirent *ent)
 	    break;
 	}
 
+      found = vol &&
+	v_getdthread(vol, HFS_CNID_ROOTDIR, &data, 0) > 0 &&
+	v_catsearch(vol, HFS_CNID_ROOTPAR, data.u.dthd.thdCName,
+		    &data, cname, 0) > 0;
+
+      if (found)
+	dir->vptr = vol->next;
+
+      UNLOCK(mountlock);
+
       if (vol == 0)
 	ERROR(ENOENT, "no more entries");
-
-      if (v_getdthread(vol, HFS_CNID_ROOTDIR, &data, 0) <= 0 ||
-	  v_catsearch(vol, HFS_CNID_ROOTPAR, data.u.dthd.thdCName,
-		      &data, cname, 0) <= 0)
+      else if (! found)
 	goto fail;
 
       r_unpackdirent(HFS_CNID_ROOTPAR, cname, &data, ent);
 
-      dir->vptr = vol->next;
-
       goto done;
     }
 
@@ -619,7 +1037,95 @@ int hfs_readdir(hfsdir *dir, hfsdirent *ent)
     }
 
 done:
-  return 0;
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	hfs->readdir_batch()
+ * DESCRIPTION:	return up to max of the next entries in the directory
+ */
+int hfs_readdir_batch(hfsdir *dir, hfsdirent *ents, unsigned int max,
+		      int fields)
+{
+  const byte *ptr;
+  unsigned int count = 0;
+
+  if (dir->dirid == 0)
+    {
+      /* the meta-directory is small; read it an entry at a time */
+
+      while (count < max)
+	{
+	  if (hfs_readdir(dir, &ents[count]) == -1)
+	    {
+	      if (errno == ENOENT)
+		break;
+
+	      goto fail;
+	    }
+
+	  ++count;
+	}
+
+      goto done;
+    }
+
+  if (dir->n.rnum == -1)
+    goto done;
+
+  while (count < max)
+    {
+      ++dir->n.rnum;
+
+      while (dir->n.rnum >= dir->n.nd.ndNRecs)
+	{
+	  if (dir->n.nd.ndFLink == 0)
+	    {
+	      dir->n.rnum = -1;
+	      goto done;
+	    }
+
+	  if (bt_getnode(&dir->n, dir->n.bt, dir->n.nd.ndFLink) == -1)
+	    {
+	      dir->n.rnum = -1;
+	      goto fail;
+	    }
+
+	  dir->n.rnum = 0;
+	}
+
+      ptr = HFS_NODEREC(dir->n, dir->n.rnum);
+
+      if (d_getul(ptr + 2) != dir->dirid)
+	{
+	  dir->n.rnum = -1;
+	  goto done;
+	}
+
+      /* decode only the record type until an entry is known to be wanted */
+
+      switch ((signed char) HFS_RECDATA(ptr)[0])
+	{
+	case cdrDirRec:
+	case cdrFilRec:
+	  r_unpackpdirent(ptr, fields, &ents[count++]);
+	  break;
+
+	case cdrThdRec:
+	case cdrFThdRec:
+	  break;
+
+	default:
+	  dir->n.rnum = -1;
+	  ERROR(EIO, "unexpected directory entry found");
+	}
+    }
+
+done:
+  return count;
 
 fail:
   return -1;
@@ -631,14 +1137,7 @@ fail:
  */
 int hfs_closedir(hfsdir *dir)
 {
-  hfsvol *vol = dir->vol;
-
-  if (dir->prev)
-    dir->prev->next = dir->next;
-  if (dir->next)
-    dir->next->prev = dir->prev;
-  if (dir == vol->dirs)
-    vol->dirs = dir->next;
+  unlinkdir(dir->vol, dir);
 
   FREE(dir);
 
@@ -711,12 +1210,7 @@ hfsfile *hfs_create(hfsvol *vol, const char *path,
 
   /* package file handle for user */
 
-  file->next = vol->files;
-
-  if (vol->files)
-    vol->files->prev = file;
-
-  vol->files = file;
+  linkfile(vol, file);
 
   return file;
 
@@ -750,16 +1244,59 @@ hfsfile *hfs_open(hfsvol *vol, const char *path)
 
   file->vol   = vol;
   file->flags = 0;
+  file->xmap  = 0;
 
   f_selectfork(file, fkData);
 
-  file->prev = 0;
-  file->next = vol->files;
+  linkfile(vol, file);
 
-  if (vol->files)
-    vol->files->prev = file;
+  return file;
 
-  vol->files = file;
+fail:
+  FREE(file);
+  return 0;
+}
+
+/*
+ * NAME:	hfs->open_id()
+ * DESCRIPTION:	prepare a file for I/O given its parent ID and name
+ */
+hfsfile *hfs_open_id(hfsvol *vol, unsigned long parid, const char *name)
+{
+  hfsfile *file = 0;
+  int found;
+
+  if (getvol(&vol) == -1)
+    goto fail;
+
+  if (*name == 0)
+    ERROR(ENOENT, "empty name");
+  else if (strlen(name) > HFS_MAX_FLEN)
+    ERROR(ENAMETOOLONG, 0);
+
+  file = ALLOC(hfsfile, 1);
+  if (file == 0)
+    ERROR(ENOMEM, 0);
+
+  found = v_catsearch(vol, parid, name, &file->cat, file->name, 0);
+  if (found == -1)
+    goto fail;
+  else if (! found)
+    ERROR(ENOENT, 0);
+
+  if (file->cat.cdrType != cdrFilRec)
+    ERROR(EISDIR, 0);
+
+  /* package file handle for user */
+
+  file->vol   = vol;
+  file->parid = parid;
+  file->flags = 0;
+  file->xmap  = 0;
+
+  f_selectfork(file, fkData);
+
+  linkfile(vol, file);
 
   return file;
 
@@ -794,36 +1331,60 @@ int hfs_getfork(hfsfile *file)
 }
 
 /*
- * NAME:	hfs->read()
- * DESCRIPTION:	read from an open file
+ * NAME:	readat()
+ * DESCRIPTION:	read from an open file at a position, advancing it
  */
-unsigned long hfs_read(hfsfile *file, void *buf, unsigned long len)
+static
+unsigned long readat(hfsfile *file, void *buf, unsigned long len,
+		     unsigned long *pos)
 {
   unsigned long *lglen, count;
   byte *ptr = buf;
 
   f_getptrs(file, 0, &lglen, 0);
 
-  if (file->pos + len > *lglen)
-    len = *lglen - file->pos;
+  if (*pos + len > *lglen)
+    len = *lglen - *pos;
 
   count = len;
   while (count)
     {
       unsigned long bnum, offs, chunk;
 
-      bnum  = file->pos >> HFS_BLOCKSZ_BITS;
-      offs  = file->pos & (HFS_BLOCKSZ - 1);
+      bnum  = *pos >> HFS_BLOCKSZ_BITS;
+      offs  = *pos & (HFS_BLOCKSZ - 1);
 
       chunk = HFS_BLOCKSZ - offs;
       if (chunk > count)
 	chunk = count;
 
-      if (offs == 0 && chunk == HFS_BLOCKSZ)
+      if (offs == 0 && count >= HFS_BLOCKBUFSZ * HFS_BLOCKSZ)
+	{
+	  unsigned long nblocks;
+
+	  /* read whole blocks directly, up to the end of the extent */
+
+	  nblocks = f_getblocks(file, bnum, (block *) ptr,
+				count >> HFS_BLOCKSZ_BITS);
+	  if (nblocks == (unsigned long) -1)
+	    goto fail;
+
+	  chunk = nblocks << HFS_BLOCKSZ_BITS;
+	}
+      else if (offs == 0 && chunk == HFS_BLOCKSZ)
 	{
 	  if (f_getblock(file, bnum, (block *) ptr) == -1)
 	    goto fail;
 	}
+      else if (file->vol->map)
+	{
+	  const block *bp;
+
+	  if (f_mapblock(file, bnum, &bp) == -1)
+	    goto fail;
+
+	  memcpy(ptr, *bp + offs, chunk);
+	}
       else
 	{
 	  block b;
@@ -836,8 +1397,8 @@ unsigned long hfs_read(hfsfile *file, void *buf, unsigned long len)
 
       ptr += chunk;
 
-      file->pos += chunk;
-      count     -= chunk;
+      *pos  += chunk;
+      count -= chunk;
     }
 
   return len;
@@ -846,6 +1407,45 @@ fail:
   return -1;
 }
 
+/*
+ * NAME:	hfs->read()
+ * DESCRIPTION:	read from an open file
+ */
+unsigned long hfs_read(hfsfile *file, void *buf, unsigned long len)
+{
+  return readat(file, buf, len, &file->pos);
+}
+
+/*
+ * NAME:	hfs->pread()
+ * DESCRIPTION:	read from an open file at an offset, leaving its position
+ */
+unsigned long hfs_pread(hfsfile *file, void *buf, unsigned long len,
+			unsigned long offset)
+{
+  unsigned long *lglen;
+  int result;
+
+  f_getptrs(file, 0, &lglen, 0);
+
+  if (offset >= *lglen)
+    return 0;
+
+  /* once the whole map is built, lookups in it no longer change it */
+
+  LOCK(file->vol->lock);
+  result = f_loadmap(file);
+  UNLOCK(file->vol->lock);
+
+  if (result == -1)
+    goto fail;
+
+  return readat(file, buf, len, &offset);
+
+fail:
+  return -1;
+}
+
 /*
  * NAME:	hfs->write()
  * DESCRIPTION:	write to an open file
@@ -1009,13 +1609,9 @@ int hfs_close(hfsfile *file)
       f_flush(file) == -1)
     result = -1;
 
-  if (file->prev)
-    file->prev->next = file->next;
-  if (file->next)
-    file->next->prev = file->prev;
-  if (file == vol->files)
-    vol->files = file->next;
+  unlinkfile(vol, file);
 
+  f_freemap(file);
   FREE(file);
 
   return result;
@@ -1045,6 +1641,66 @@ fail:
   return -1;
 }
 
+/*
+ * NAME:	hfs->stat_id()
+ * DESCRIPTION:	return catalog information given a parent ID and name
+ */
+int hfs_stat_id(hfsvol *vol, unsigned long parid, const char *name,
+		hfsdirent *ent)
+{
+  CatDataRec data;
+  char tname[HFS_MAX_FLEN + 1], cname[HFS_MAX_FLEN + 1];
+  int found;
+
+  if (getvol(&vol) == -1)
+    goto fail;
+
+  if (strlen(name) > HFS_MAX_FLEN)
+    ERROR(ENAMETOOLONG, 0);
+
+  if (*name == 0)
+    {
+      /* the item whose ID was given, found through its thread */
+
+      found = v_catsearch(vol, parid, "", &data, 0, 0);
+      if (found == -1)
+	goto fail;
+      else if (! found)
+	ERROR(ENOENT, 0);
+
+      switch (data.cdrType)
+	{
+	case cdrThdRec:
+	  parid = data.u.dthd.thdParID;
+	  strcpy(tname, data.u.dthd.thdCName);
+	  break;
+
+	case cdrFThdRec:
+	  parid = data.u.fthd.fthdParID;
+	  strcpy(tname, data.u.fthd.fthdCName);
+	  break;
+
+	default:
+	  ERROR(EIO, "bad thread record");
+	}
+
+      name = tname;
+    }
+
+  found = v_catsearch(vol, parid, name, &data, cname, 0);
+  if (found == -1)
+    goto fail;
+  else if (! found)
+    ERROR(ENOENT, 0);
+
+  r_unpackdirent(parid, cname, &data, ent);
+
+  return 0;
+
+fail:
+  return -1;
+}
+
 /*
  * NAME:	hfs->fstat()
  * DESCRIPTION:	return catalog information for an open file
@@ -1165,6 +1821,8 @@ int hfs_rmdir(hfsvol *vol, const char *path)
   r_makecatkey(&key, parid, name);
   r_packcatkey(&key, pkey, 0);
 
+  v_dpurge(vol, parid, name);
+
   if (bt_delete(&vol->cat, pkey) == -1)
     goto fail;
 
@@ -1173,6 +1831,8 @@ int hfs_rmdir(hfsvol *vol, const char *path)
   r_makecatkey(&key, data.u.dir.dirDirID, "");
   r_packcatkey(&key, pkey, 0);
 
+  v_dpurge(vol, data.u.dir.dirDirID, "");
+
   if (bt_delete(&vol->cat, pkey) == -1 ||
       v_adjvalence(vol, parid, 1, -1) == -1)
     goto fail;
@@ -1211,6 +1871,7 @@ int hfs_delete(hfsvol *vol, const char *path)
 
   file.vol   = vol;
   file.flags = 0;
+  file.xmap  = 0;
 
   file.cat.u.fil.filLgLen  = 0;
   file.cat.u.fil.filRLgLen = 0;
@@ -1228,6 +1889,8 @@ int hfs_delete(hfsvol *vol, const char *path)
   r_makecatkey(&key, file.parid, file.name);
   r_packcatkey(&key, pkey, 0);
 
+  v_dpurge(vol, file.parid, file.name);
+
   if (bt_delete(&vol->cat, pkey) == -1 ||
       v_adjvalence(vol, file.parid, 0, -1) == -1)
     goto fail;
@@ -1243,6 +1906,8 @@ int hfs_delete(hfsvol *vol, const char *path)
       r_makecatkey(&key, file.cat.u.fil.filFlNum, "");
       r_packcatkey(&key, pkey, 0);
 
+      v_dpurge(vol, file.cat.u.fil.filFlNum, "");
+
       if (bt_delete(&vol->cat, pkey) == -1)
 	goto fail;
     }
@@ -1365,6 +2030,8 @@ int hfs_rename(hfsvol *vol, const char *srcpath, const char *dstpath)
   r_makecatkey(&key, srcid, srcname);
   r_packcatkey(&key, record, 0);
 
+  v_dpurge(vol, srcid, srcname);
+
   if (bt_delete(&vol->cat, record) == -1)
     goto fail;
 
@@ -1421,6 +2088,239 @@ fail:
   return -1;
 }
 
+typedef struct {
+  unsigned long id;		/* directory ID */
+  unsigned long parid;		/* ID of parent directory */
+  char name[HFS_MAX_FLEN + 1];	/* name of directory */
+} walkdir;
+
+typedef struct {
+  int fields;			/* fields of each entry to fill */
+  hfswalkfunc func;		/* caller's function */
+  void *arg;			/* caller's argument */
+
+  hfsdirent *ents;		/* entries held for the path pass */
+  unsigned long nents;		/* number of entries held */
+  unsigned long entsz;		/* number of entries allocated */
+
+  walkdir *dirs;		/* directory threads, in ID order */
+  unsigned long ndirs;		/* number of threads held */
+  unsigned long dirsz;		/* number of threads allocated */
+
+  char *path;			/* path buffer */
+  unsigned long pathsz;		/* bytes allocated for path buffer */
+} walkstate;
+
+/*
+ * NAME:	walkrec()
+ * DESCRIPTION:	report or hold a catalog leaf record during hfs_catwalk()
+ */
+static
+int walkrec(const byte *ptr, void *arg)
+{
+  walkstate *ws = arg;
+  hfsdirent ent;
+  CatDataRec data;
+
+  switch ((signed char) HFS_RECDATA(ptr)[0])
+    {
+    case cdrDirRec:
+    case cdrFilRec:
+      if (! (ws->fields & HFS_DIRENT_PATH))
+	{
+	  r_unpackpdirent(ptr, ws->fields, &ent);
+
+	  return ws->func(ws->arg, &ent, 0);
+	}
+
+      if (ws->nents == ws->entsz)
+	{
+	  hfsdirent *ents;
+
+	  ents = REALLOC(ws->ents, hfsdirent, ws->entsz ? 2 * ws->entsz : 256);
+	  if (ents == 0)
+	    ERROR(ENOMEM, 0);
+
+	  ws->ents   = ents;
+	  ws->entsz  = ws->entsz ? 2 * ws->entsz : 256;
+	}
+
+      r_unpackpdirent(ptr, ws->fields, &ws->ents[ws->nents++]);
+      break;
+
+    case cdrThdRec:
+      if (! (ws->fields & HFS_DIRENT_PATH))
+	break;
+
+      if (ws->ndirs == ws->dirsz)
+	{
+	  walkdir *dirs;
+
+	  dirs = REALLOC(ws->dirs, walkdir, ws->dirsz ? 2 * ws->dirsz : 64);
+	  if (dirs == 0)
+	    ERROR(ENOMEM, 0);
+
+	  ws->dirs  = dirs;
+	  ws->dirsz = ws->dirsz ? 2 * ws->dirsz : 64;
+	}
+
+      /* thread keys sort by directory ID, so the table stays in order */
+
+      r_unpackcatdata(HFS_RECDATA(ptr), &data);
+
+      ws->dirs[ws->ndirs].id    = d_getul(ptr + 2);
+      ws->dirs[ws->ndirs].parid = data.u.dthd.thdParID;
+      strcpy(ws->dirs[ws->ndirs].name, data.u.dthd.thdCName);
+
+      ++ws->ndirs;
+      break;
+    }
+
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	finddir()
+ * DESCRIPTION:	locate a directory thread held by hfs_catwalk()
+ */
+static
+const walkdir *finddir(const walkstate *ws, unsigned long id)
+{
+  unsigned long lo = 0, hi = ws->ndirs, mid;
+
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+
+      if (ws->dirs[mid].id == id)
+	return &ws->dirs[mid];
+      else if (ws->dirs[mid].id < id)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  return 0;
+}
+
+/*
+ * NAME:	walkpath()
+ * DESCRIPTION:	construct the full pathname of an entry held by hfs_catwalk()
+ */
+static
+const char *walkpath(walkstate *ws, const hfsdirent *ent)
+{
+  const walkdir *dir;
+  unsigned long id, len, depth = 0;
+  unsigned int n;
+  char *ptr;
+
+  /* the root directory is "Volume:"; anything else "Volume:dir:...:name" */
+
+  len = strlen(ent->name) + (ent->parid == HFS_CNID_ROOTPAR) + 1;
+
+  for (id = ent->parid; id != HFS_CNID_ROOTPAR; id = dir->parid)
+    {
+      dir = finddir(ws, id);
+      if (dir == 0 || ++depth > ws->ndirs)
+	ERROR(EIO, "broken directory thread chain");
+
+      len += strlen(dir->name) + 1;
+    }
+
+  if (len > ws->pathsz)
+    {
+      FREE(ws->path);
+
+      ws->path = ALLOC(char, len);
+      if (ws->path == 0)
+	{
+	  ws->pathsz = 0;
+	  ERROR(ENOMEM, 0);
+	}
+
+      ws->pathsz = len;
+    }
+
+  ptr = ws->path + len;
+
+  *--ptr = 0;
+
+  if (ent->parid == HFS_CNID_ROOTPAR)
+    *--ptr = ':';
+
+  n = strlen(ent->name);
+  ptr -= n;
+  memcpy(ptr, ent->name, n);
+
+  for (id = ent->parid; id != HFS_CNID_ROOTPAR &&
+	 (dir = finddir(ws, id)) != 0; id = dir->parid)
+    {
+      *--ptr = ':';
+
+      n = strlen(dir->name);
+      ptr -= n;
+      memcpy(ptr, dir->name, n);
+    }
+
+  return ws->path;
+
+fail:
+  return 0;
+}
+
+/*
+ * NAME:	hfs->catwalk()
+ * DESCRIPTION:	call a function for every file and directory on a volume
+ */
+int hfs_catwalk(hfsvol *vol, int fields, hfswalkfunc func, void *arg)
+{
+  walkstate ws;
+  const char *path;
+  unsigned long i;
+  int result;
+
+  if (getvol(&vol) == -1)
+    return -1;
+
+  ws.fields = fields;
+  ws.func   = func;
+  ws.arg    = arg;
+
+  ws.ents   = 0;
+  ws.nents  = 0;
+  ws.entsz  = 0;
+
+  ws.dirs   = 0;
+  ws.ndirs  = 0;
+  ws.dirsz  = 0;
+
+  ws.path   = 0;
+  ws.pathsz = 0;
+
+  result = bt_walk(&vol->cat, walkrec, &ws);
+
+  /* with paths requested, report everything once all threads are known */
+
+  for (i = 0; result == 0 && i < ws.nents; ++i)
+    {
+      path = walkpath(&ws, &ws.ents[i]);
+      if (path == 0)
+	result = -1;
+      else
+	result = func(arg, &ws.ents[i], path);
+    }
+
+  FREE(ws.ents);
+  FREE(ws.dirs);
+  FREE(ws.path);
+
+  return result;
+}
+
 /* High-Level Media Routines =============================================== */
 
 /*
@@ -1630,7 +2530,7 @@ int hfs_format(const char *path, int pnum, int mode, const char *vname,
 
   memset(vol.vbm, 0, vol.vbmsz << HFS_BLOCKSZ_BITS);
 
-  vol.flags |= HFS_VOL_UPDATE_VBM;
+  v_dirtyvbm(&vol, 0, vol.vbmsz << (HFS_BLOCKSZ_BITS + 3));
 
   /* perform initial bad block sparing */
 
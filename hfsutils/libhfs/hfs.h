@@ -51,6 +51,29 @@ typedef struct {
   unsigned long blessed;	/* CNID of MacOS System Folder */
 } hfsvolent;
 
+typedef struct {
+  int policy;			/* block cache replacement policy */
+  unsigned long size;		/* cache capacity in bytes */
+
+  unsigned long hits;		/* number of cache hits */
+  unsigned long misses;		/* number of cache misses */
+
+  unsigned long inhits;		/* 2Q: hits on blocks in the A1in queue */
+  unsigned long mainhits;	/* 2Q: hits on blocks in the Am queue */
+  unsigned long ghosthits;	/* 2Q: misses on blocks recently evicted */
+
+  unsigned long rawindow;	/* current read-ahead window in bytes */
+  unsigned long rapeak;		/* largest read-ahead window in bytes */
+  unsigned long rablocks;	/* number of blocks read ahead */
+  unsigned long rahits;		/* read-ahead blocks later requested */
+  unsigned long rawasted;	/* read-ahead blocks evicted unrequested */
+
+  unsigned long cathits;	/* catalog nodes found already parsed */
+  unsigned long catmisses;	/* catalog nodes read and parsed */
+  unsigned long exthits;	/* extents nodes found already parsed */
+  unsigned long extmisses;	/* extents nodes read and parsed */
+} hfscachestat;
+
 typedef struct {
   char name[HFS_MAX_FLEN + 1];	/* catalog name (MacOS Standard Roman) */
   int flags;			/* bit flags */
@@ -90,9 +113,49 @@ typedef struct {
   } u;
 } hfsdirent;
 
+typedef int (*hfswalkfunc)(void *, const hfsdirent *, const char *);
+
+typedef unsigned long (*hfsreadfunc)(void *, void *,
+				     unsigned long, unsigned long);
+typedef unsigned long (*hfswritefunc)(void *, const void *,
+				      unsigned long, unsigned long);
+typedef unsigned long (*hfsreadvfunc)(void *, void *const [],
+				      unsigned long, unsigned long);
+typedef unsigned long (*hfswritevfunc)(void *, const void *const [],
+				       unsigned long, unsigned long);
+typedef struct {
+  int write;			/* nonzero to write rather than read */
+  unsigned long bnum;		/* first block to transfer */
+  unsigned long len;		/* number of blocks to transfer */
+  void *const *bufs;		/* buffer for each block */
+  unsigned long count;		/* blocks transferred, or -1 on error */
+} hfsioreq;
+
+typedef int (*hfsbatchfunc)(void *, hfsioreq *, unsigned int);
+typedef unsigned long (*hfssizefunc)(void *);
+typedef const void *(*hfsmapfunc)(void *, unsigned long *);
+typedef int (*hfsclosefunc)(void *);
+
+struct hfsioprocs {
+  hfsreadfunc	read;
+  hfswritefunc	write;
+  hfsreadvfunc	readv;
+  hfswritevfunc	writev;
+  hfssizefunc	size;
+  hfsmapfunc	map;
+  hfsclosefunc	close;
+  hfsbatchfunc	batch;
+};
+
 # define HFS_ISDIR		0x0001
 # define HFS_ISLOCKED		0x0002
 
+# define HFS_DIRENT_DATES	0x0001	/* crdate, mddate, bkdate */
+# define HFS_DIRENT_FINDER	0x0002	/* fdflags, fdlocation, type, creator, rect */
+# define HFS_DIRENT_SIZES	0x0004	/* dsize, rsize, valence */
+# define HFS_DIRENT_ALL		0x0007
+# define HFS_DIRENT_PATH	0x0008	/* full pathname (hfs_catwalk() only) */
+
 # define HFS_CNID_ROOTPAR	1
 # define HFS_CNID_ROOTDIR	2
 # define HFS_CNID_EXT		3
@@ -114,7 +177,13 @@ typedef struct {
 # define HFS_FNDR_ISINVISIBLE		(1 << 14)
 # define HFS_FNDR_ISALIAS		(1 << 15)
 
+# ifdef ENABLE_THREADS
+const char **hfs_errorp(void);
+#  define hfs_error	(*hfs_errorp())
+# else
 extern const char *hfs_error;
+# endif
+
 extern const unsigned char hfs_charorder[];
 
 # define HFS_MODE_RDONLY	0
@@ -126,18 +195,27 @@ extern const unsigned char hfs_charorder[];
 # define HFS_OPT_NOCACHE	0x0100
 # define HFS_OPT_2048		0x0200
 # define HFS_OPT_ZERO		0x0400
+# define HFS_OPT_BESTFIT	0x0800
+
+# define HFS_CACHE_CLASSIC	0
+# define HFS_CACHE_2Q		1
 
 # define HFS_SEEK_SET		0
 # define HFS_SEEK_CUR		1
 # define HFS_SEEK_END		2
 
 hfsvol *hfs_mount(const char *, int, int);
+hfsvol *hfs_mount_io(void *, const struct hfsioprocs *, int, int);
+hfsvol *hfs_mount_mem(void *, unsigned long, int, int);
 int hfs_flush(hfsvol *);
 void hfs_flushall(void);
 int hfs_umount(hfsvol *);
 void hfs_umountall(void);
 hfsvol *hfs_getvol(const char *);
 void hfs_setvol(hfsvol *);
+int hfs_setcachesz(hfsvol *, unsigned long);
+int hfs_setcachepolicy(hfsvol *, int);
+int hfs_cachestat(hfsvol *, hfscachestat *);
 
 int hfs_vstat(hfsvol *, hfsvolent *);
 int hfs_vsetattr(hfsvol *, hfsvolent *);
@@ -148,20 +226,25 @@ int hfs_setcwd(hfsvol *, unsigned long);
 int hfs_dirinfo(hfsvol *, unsigned long *, char *);
 
 hfsdir *hfs_opendir(hfsvol *, const char *);
+hfsdir *hfs_opendir_id(hfsvol *, unsigned long);
 int hfs_readdir(hfsdir *, hfsdirent *);
+int hfs_readdir_batch(hfsdir *, hfsdirent *, unsigned int, int);
 int hfs_closedir(hfsdir *);
 
 hfsfile *hfs_create(hfsvol *, const char *, const char *, const char *);
 hfsfile *hfs_open(hfsvol *, const char *);
+hfsfile *hfs_open_id(hfsvol *, unsigned long, const char *);
 int hfs_setfork(hfsfile *, int);
 int hfs_getfork(hfsfile *);
 unsigned long hfs_read(hfsfile *, void *, unsigned long);
+unsigned long hfs_pread(hfsfile *, void *, unsigned long, unsigned long);
 unsigned long hfs_write(hfsfile *, const void *, unsigned long);
 int hfs_truncate(hfsfile *, unsigned long);
 unsigned long hfs_seek(hfsfile *, long, int);
 int hfs_close(hfsfile *);
 
 int hfs_stat(hfsvol *, const char *, hfsdirent *);
+int hfs_stat_id(hfsvol *, unsigned long, const char *, hfsdirent *);
 int hfs_fstat(hfsfile *, hfsdirent *);
 int hfs_setattr(hfsvol *, const char *, const hfsdirent *);
 int hfs_fsetattr(hfsfile *, const hfsdirent *);
@@ -172,6 +255,8 @@ int hfs_rmdir(hfsvol *, const char *);
 int hfs_delete(hfsvol *, const char *);
 int hfs_rename(hfsvol *, const char *, const char *);
 
+int hfs_catwalk(hfsvol *, int, hfswalkfunc, void *);
+
 int hfs_zero(const char *, unsigned int, unsigned long *);
 int hfs_mkpart(const char *, unsigned long);
 int hfs_nparts(const char *);
@@ -50,9 +50,33 @@ extern int errno;
 # define BMCLR(bm, num)  \
           (((byte *) (bm))[(num) >> 3] &= ~(0x80 >> ((num) & 0x07)))
 
+# define HFS_VBMBLOCK(anum)	((anum) >> (HFS_BLOCKSZ_BITS + 3))
+
 # define STRINGIZE(x)		#x
 # define STR(x)			STRINGIZE(x)
 
+/* locks guarding structures shared by threads reading a volume */
+
+# ifdef ENABLE_THREADS
+#  include <pthread.h>
+
+typedef pthread_mutex_t hfslock;
+
+#  define LOCKINITIALIZER	PTHREAD_MUTEX_INITIALIZER
+#  define LOCKINIT(lk)		((void) pthread_mutex_init(&(lk), 0))
+#  define LOCKFREE(lk)		((void) pthread_mutex_destroy(&(lk)))
+#  define LOCK(lk)		((void) pthread_mutex_lock(&(lk)))
+#  define UNLOCK(lk)		((void) pthread_mutex_unlock(&(lk)))
+# else
+typedef int hfslock;
+
+#  define LOCKINITIALIZER	0
+#  define LOCKINIT(lk)		((void) (lk))
+#  define LOCKFREE(lk)		((void) (lk))
+#  define LOCK(lk)		((void) (lk))
+#  define UNLOCK(lk)		((void) (lk))
+# endif
+
 typedef unsigned char byte;
 typedef byte block[HFS_BLOCKSZ];
 
@@ -72,22 +96,65 @@ typedef struct _bucket_ {
 
 # define HFS_BUCKET_INUSE	0x01
 # define HFS_BUCKET_DIRTY	0x02
+# define HFS_BUCKET_A1IN	0x04
+# define HFS_BUCKET_AHEAD	0x08
+# define HFS_BUCKET_GHOST	0x10
 
-# define HFS_CACHESZ		128
-# define HFS_HASHSZ		32
+typedef struct {
+  unsigned long bnum;		/* block number evicted from the cache */
+  int hnext;			/* index of next ghost in hash chain (or -1) */
+} ghost;
+
+# define HFS_CACHESZ		128	/* default number of cache buckets */
+# define HFS_HASHLOAD		4	/* cache buckets per hash slot */
 # define HFS_BLOCKBUFSZ		16
+# define HFS_RAMAX		2048	/* largest read-ahead window (blocks) */
 
 typedef struct {
   struct _hfsvol_ *vol;		/* volume to which cache belongs */
-  bucket *tail;			/* end of bucket chain */
+  hfslock lock;			/* guards the whole cache */
+  bucket *tail;			/* end of bucket chain (2Q: Am queue) */
+  int policy;			/* replacement policy */
+
+  unsigned long hits;		/* number of cache hits */
+  unsigned long misses;		/* number of cache misses */
+
+  unsigned int size;		/* number of buckets in cache */
+  unsigned int hashsz;		/* number of hash slots (a power of 2) */
+
+  bucket *chain;		/* cache bucket chain */
+  bucket **hash;		/* hash table for bucket chain */
+  bucket **list;		/* scratch array for flushing buckets */
+  bucket **runs;		/* scratch array of buckets being transferred */
+  void **bufs;			/* scratch array of their block buffers */
+  hfsioreq *reqs;		/* scratch array of batched transfers */
+
+  block *pool;			/* physical blocks in cache */
+
+  bucket *intail;		/* 2Q: end of A1in (first reference) queue */
+  unsigned int inlen;		/* 2Q: number of buckets in A1in */
+  unsigned int inmax;		/* 2Q: target size of A1in */
+
+  ghost *ghosts;		/* 2Q: ring of blocks evicted from A1in */
+  int *ghash;			/* 2Q: hash table for ghost ring */
+  unsigned int gmax;		/* 2Q: number of ghosts remembered */
+  unsigned int gpos;		/* 2Q: next ghost ring slot to replace */
+
+  unsigned long inhits;		/* 2Q: number of hits in A1in */
+  unsigned long mainhits;	/* 2Q: number of hits in Am */
+  unsigned long ghosthits;	/* 2Q: number of misses found in ghost ring */
 
-  unsigned int hits;		/* number of cache hits */
-  unsigned int misses;		/* number of cache misses */
+  unsigned long ranext;		/* block expected next from a sequential scan */
+  unsigned int rawin;		/* current read-ahead window (blocks) */
+  unsigned int ramax;		/* largest permitted read-ahead window */
+  unsigned int rapeak;		/* largest read-ahead window used */
 
-  bucket chain[HFS_CACHESZ];	/* cache bucket chain */
-  bucket *hash[HFS_HASHSZ];	/* hash table for bucket chain */
+  bucket **rachain;		/* scratch array of buckets being read ahead */
+  bucket ***raslots;		/* scratch array of their hash slots */
 
-  block pool[HFS_CACHESZ];	/* physical blocks in cache */
+  unsigned long rablocks;	/* number of blocks read ahead */
+  unsigned long rahits;		/* number of read-ahead blocks later used */
+  unsigned long rawasted;	/* number of read-ahead blocks never used */
 } bcache;
 
 # define HFS_MAP1SZ  256
@@ -127,6 +194,14 @@ typedef struct {
 # define HFS_ATRB_COPYPROT	(1 << 14)
 # define HFS_ATRB_SLOCKED	(1 << 15)
 
+typedef struct {
+  unsigned int fabn;		/* first file allocation block of extent */
+  unsigned int stabn;		/* first volume allocation block */
+  unsigned int count;		/* number of allocation blocks */
+} fextent;
+
+# define HFS_XMAPSZ	4	/* initial size of a file's extent map */
+
 struct _hfsfile_ {
   struct _hfsvol_ *vol;		/* pointer to volume descriptor */
   unsigned long parid;		/* parent directory ID of this file */
@@ -135,6 +210,12 @@ struct _hfsfile_ {
   ExtDataRec ext;		/* current extent record */
   unsigned int fabn;		/* starting file allocation block number */
   int fork;			/* current selected fork for I/O */
+
+  fextent *xmap;		/* sorted map of extents read so far (or 0) */
+  unsigned int xmaplen;		/* number of extents in map */
+  unsigned int xmapsz;		/* number of extents allocated for map */
+  unsigned int xmapend;		/* file allocation blocks covered by map */
+
   unsigned long pos;		/* current file seek pointer */
   int flags;			/* bit flags */
 
@@ -167,8 +248,9 @@ struct _hfsdir_ {
   struct _hfsdir_ *next;
 };
 
-typedef void (*keyunpackfunc)(const byte *, void *);
-typedef int (*keycomparefunc)(const void *, const void *);
+typedef int (*keycomparefunc)(const byte *, const byte *);
+
+# define HFS_NCACHESZ	16	/* number of parsed nodes cached per B*-tree */
 
 typedef struct _btree_ {
   hfsfile f;			/* subset file information */
@@ -178,16 +260,59 @@ typedef struct _btree_ {
   unsigned long mapsz;		/* number of bytes in bitmap */
   int flags;			/* bit flags */
 
-  keyunpackfunc keyunpack;	/* key unpacking function */
-  keycomparefunc keycompare;	/* key comparison function */
+  keycomparefunc keycompare;	/* packed key comparison function */
+
+  hfslock lock;			/* guards node reads, ncache, and f's state */
+  node *ncache;			/* parsed nodes, indexed by node number (or 0) */
+  unsigned long nhits;		/* number of nodes found in ncache */
+  unsigned long nmisses;	/* number of nodes read from the file */
 } btree;
 
 # define HFS_BT_UPDATE_HDR	0x01
 
+# define HFS_DCACHESZ	256	/* number of catalog records cached per volume */
+
+typedef struct {
+  unsigned long parid;		/* parent ID (or CNID, for a thread) */
+  char name[HFS_MAX_FLEN + 1];	/* catalog name as stored (empty for a thread) */
+  CatDataRec data;		/* catalog record */
+  int hnext;			/* index of next dentry in hash chain (or -1) */
+} dentry;
+
+typedef struct {
+  dentry ring[HFS_DCACHESZ];	/* recently found catalog records */
+  int hash[HFS_DCACHESZ];	/* hash table for ring */
+  unsigned int pos;		/* next ring slot to replace */
+} dcache;
+
+# define HFS_ALLOCWIN	512	/* blocks searched near the allocation pointer */
+# define HFS_FMSAVESZ	256	/* bitmap bytes that may await reindexing */
+
+typedef struct _frun_ {
+  unsigned int start;		/* first free allocation block */
+  unsigned int count;		/* number of free allocation blocks */
+  unsigned int prio;		/* treap priority */
+  unsigned int maxcount;	/* largest count in address subtree */
+  struct _frun_ *alo, *ahi;	/* address-ordered subtrees */
+  struct _frun_ *slo, *shi;	/* size-ordered subtrees */
+} frun;
+
+typedef struct {
+  frun *byaddr;			/* free runs ordered by start */
+  frun *bysize;			/* free runs ordered by count, then start */
+  unsigned int nruns;		/* number of free runs */
+  unsigned int dlo, dhi;	/* bitmap bytes changed since indexed */
+  byte saved[HFS_FMSAVESZ];	/* those bytes as last indexed */
+} fmap;
+
 struct _hfsvol_ {
-  void *priv;		/* OS-dependent private descriptor data */
+  struct hfsioprocs io;	/* medium access procedures */
+  void *priv;		/* private medium access data */
   int flags;		/* bit flags */
 
+  const block *map;	/* read-only memory mapping of medium (or 0) */
+  unsigned long mapsz;	/* number of physical blocks mapped */
+
   int pnum;		/* ordinal HFS partition number */
   unsigned long vstart;	/* logical block offset to start of volume */
   unsigned long vlen;	/* number of logical blocks in volume */
@@ -198,9 +323,17 @@ struct _hfsvol_ {
   MDB mdb;		/* master directory block */
   block *vbm;		/* volume bitmap */
   unsigned short vbmsz;	/* number of blocks in bitmap */
+  byte *vbmload;	/* which bitmap blocks have been read (or 0 if all) */
+  unsigned short vbmlo;	/* first bitmap block changed since written */
+  unsigned short vbmhi;	/* one past last bitmap block changed */
+  fmap *fmap;		/* index of free runs in bitmap (or 0) */
 
   btree ext;		/* B*-tree control block for extents overflow file */
   btree cat;		/* B*-tree control block for catalog file */
+  dcache *dcache;	/* cache of resolved catalog records (or 0) */
+
+  hfslock lock;		/* guards files, dirs, map loads */
+  hfslock dlock;		/* guards dcache */
 
   unsigned long cwd;	/* directory id of current working directory */
 
@@ -216,6 +349,7 @@ struct _hfsvol_ {
 # define HFS_VOL_MOUNTED	0x0002
 # define HFS_VOL_READONLY	0x0004
 # define HFS_VOL_USINGCACHE	0x0008
+# define HFS_VOL_OSMEDIUM	0x0080
 
 # define HFS_VOL_UPDATE_MDB	0x0010
 # define HFS_VOL_UPDATE_ALTMDB	0x0020
@@ -0,0 +1,141 @@
+/*
+ * libhfs - library for reading and writing Macintosh HFS volumes
+ * Copyright (C) 1996-1998 Robert Leslie
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * $Id$
+ */
+
+# ifdef HAVE_CONFIG_H
+#  include "config.h"
+# endif
+
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+
+# include "libhfs.h"
+# include "mem.h"
+
+typedef struct {
+  block *base;			/* start of medium in memory */
+  unsigned long len;		/* number of blocks in medium */
+} medium;
+
+const struct hfsioprocs mem_procs = {
+  mem_read,
+  mem_write,
+  0,
+  0,
+  mem_size,
+  mem_map,
+  mem_close,
+  0
+};
+
+/*
+ * NAME:	mem->open()
+ * DESCRIPTION:	prepare a memory buffer for use as a medium
+ */
+void *mem_open(void *buf, unsigned long size)
+{
+  medium *m;
+
+  m = ALLOC(medium, 1);
+  if (m == 0)
+    ERROR(ENOMEM, 0);
+
+  m->base = buf;
+  m->len  = size >> HFS_BLOCKSZ_BITS;
+
+  return m;
+
+fail:
+  return 0;
+}
+
+/*
+ * NAME:	mem->read()
+ * DESCRIPTION:	read blocks from a memory medium
+ */
+unsigned long mem_read(void *priv, void *buf, unsigned long len,
+		       unsigned long bnum)
+{
+  medium *m = priv;
+
+  if (bnum >= m->len)
+    return 0;
+
+  if (len > m->len - bnum)
+    len = m->len - bnum;
+
+  memcpy(buf, m->base + bnum, len << HFS_BLOCKSZ_BITS);
+
+  return len;
+}
+
+/*
+ * NAME:	mem->write()
+ * DESCRIPTION:	write blocks to a memory medium
+ */
+unsigned long mem_write(void *priv, const void *buf, unsigned long len,
+			unsigned long bnum)
+{
+  medium *m = priv;
+
+  if (bnum >= m->len)
+    return 0;
+
+  if (len > m->len - bnum)
+    len = m->len - bnum;
+
+  memcpy(m->base + bnum, buf, len << HFS_BLOCKSZ_BITS);
+
+  return len;
+}
+
+/*
+ * NAME:	mem->size()
+ * DESCRIPTION:	return the number of blocks in a memory medium
+ */
+unsigned long mem_size(void *priv)
+{
+  return ((medium *) priv)->len;
+}
+
+/*
+ * NAME:	mem->map()
+ * DESCRIPTION:	return a memory medium's buffer for direct reading
+ */
+const void *mem_map(void *priv, unsigned long *len)
+{
+  medium *m = priv;
+
+  *len = m->len;
+
+  return m->base;
+}
+
+/*
+ * NAME:	mem->close()
+ * DESCRIPTION:	release a memory medium (but not its buffer)
+ */
+int mem_close(void *priv)
+{
+  FREE(priv);
+
+  return 0;
+}
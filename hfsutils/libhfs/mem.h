@@ -0,0 +1,32 @@
+/*
+ * libhfs - library for reading and writing Macintosh HFS volumes
+ * Copyright (C) 1996-1998 Robert Leslie
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * $Id$
+ */
+
+extern const struct hfsioprocs mem_procs;
+
+void *mem_open(void *, unsigned long);
+
+unsigned long mem_read(void *, void *, unsigned long, unsigned long);
+unsigned long mem_write(void *, const void *, unsigned long, unsigned long);
+
+unsigned long mem_size(void *);
+const void *mem_map(void *, unsigned long *);
+
+int mem_close(void *);
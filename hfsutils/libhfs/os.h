@@ -19,11 +19,25 @@
  * $Id: os.h,v 1.6 1998/09/15 19:21:05 rob Exp $
  */
 
+extern const struct hfsioprocs os_procs;
+
 int os_open(void **, const char *, int);
-int os_close(void **);
+int os_close(void *);
+
+int os_same(void *, const char *);
+
+unsigned long os_seek(void *, unsigned long);
+unsigned long os_size(void *);
+unsigned long os_read(void *, void *, unsigned long);
+unsigned long os_write(void *, const void *, unsigned long);
+
+unsigned long os_pread(void *, void *, unsigned long, unsigned long);
+unsigned long os_pwrite(void *, const void *, unsigned long, unsigned long);
+
+unsigned long os_preadv(void *, void *const [], unsigned long, unsigned long);
+unsigned long os_pwritev(void *, const void *const [],
+			 unsigned long, unsigned long);
 
-int os_same(void **, const char *);
+int os_batch(void *, hfsioreq *, unsigned int);
 
-unsigned long os_seek(void **, unsigned long);
-unsigned long os_read(void **, void *, unsigned long);
-unsigned long os_write(void **, const void *, unsigned long);
+const void *os_map(void *, unsigned long *);
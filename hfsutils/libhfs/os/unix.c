@@ -28,16 +28,162 @@
 #  include "config.h"
 # endif
 
+# include <stdlib.h>
 # include <fcntl.h>
 # include <unistd.h>
 # include <sys/types.h>
 # include <errno.h>
 # include <sys/stat.h>
-# include <stdint.h>
+# include <sys/uio.h>
+
+# if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#  include <sys/mman.h>
+#  define USE_MMAP
+# endif
+
+# if defined(ENABLE_IO_URING) && defined(HAVE_LINUX_IO_URING_H)
+#  include <string.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <linux/io_uring.h>
+#  if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#   define USE_IO_URING
+#  endif
+# endif
 
 # include "libhfs.h"
 # include "os.h"
 
+# ifdef USE_IO_URING
+# define RINGSZ	64
+
+typedef struct {
+  int fd;			/* io_uring descriptor */
+  unsigned int entries;		/* number of submission queue entries */
+
+  void *sqring;			/* mapped submission queue ring */
+  size_t sqringsz;
+  void *cqring;			/* mapped completion queue ring */
+  size_t cqringsz;
+
+  struct io_uring_sqe *sqes;	/* mapped submission queue entries */
+  size_t sqesz;
+
+  unsigned int *sqhead;		/* submission queue indices */
+  unsigned int *sqtail;
+  unsigned int *sqmask;
+  unsigned int *sqarray;
+
+  unsigned int *cqhead;		/* completion queue indices */
+  unsigned int *cqtail;
+  unsigned int *cqmask;
+
+  struct io_uring_cqe *cqes;	/* completion queue entries */
+} ring;
+# endif
+
+typedef struct {
+  int fd;			/* open file descriptor */
+  void *map;			/* read-only mapping of the medium (or 0) */
+  unsigned long mapsz;		/* number of blocks mapped */
+
+# ifdef USE_IO_URING
+  ring *ring;			/* asynchronous I/O ring (or 0) */
+  int noring;			/* nonzero once the ring has refused work */
+# endif
+} medium;
+
+# define FD(priv)	(((medium *) (priv))->fd)
+
+const struct hfsioprocs os_procs = {
+  os_pread,
+  os_pwrite,
+  os_preadv,
+  os_pwritev,
+  os_size,
+  os_map,
+  os_close,
+  os_batch
+};
+
+# ifdef USE_IO_URING
+/*
+ * NAME:	freering()
+ * DESCRIPTION:	tear down an asynchronous I/O ring
+ */
+static
+void freering(ring *r)
+{
+  if (r->sqes != MAP_FAILED)
+    munmap(r->sqes, r->sqesz);
+  if (r->cqring != MAP_FAILED)
+    munmap(r->cqring, r->cqringsz);
+  if (r->sqring != MAP_FAILED)
+    munmap(r->sqring, r->sqringsz);
+
+  close(r->fd);
+
+  FREE(r);
+}
+
+/*
+ * NAME:	newring()
+ * DESCRIPTION:	set up an asynchronous I/O ring; return 0 if not supported
+ */
+static
+ring *newring(void)
+{
+  struct io_uring_params p;
+  ring *r;
+
+  r = ALLOC(ring, 1);
+  if (r == 0)
+    return 0;
+
+  memset(&p, 0, sizeof(p));
+
+  r->fd = syscall(__NR_io_uring_setup, RINGSZ, &p);
+  if (r->fd == -1)
+    {
+      FREE(r);
+      return 0;
+    }
+
+  r->entries  = p.sq_entries;
+
+  r->sqringsz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  r->cqringsz = p.cq_off.cqes  + p.cq_entries * sizeof(struct io_uring_cqe);
+  r->sqesz    = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  r->sqring = mmap(0, r->sqringsz, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  r->cqring = mmap(0, r->cqringsz, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+  r->sqes   = mmap(0, r->sqesz,    PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+
+  if (r->sqring == MAP_FAILED ||
+      r->cqring == MAP_FAILED ||
+      r->sqes   == MAP_FAILED)
+    {
+      freering(r);
+      return 0;
+    }
+
+  r->sqhead  = (unsigned int *) ((char *) r->sqring + p.sq_off.head);
+  r->sqtail  = (unsigned int *) ((char *) r->sqring + p.sq_off.tail);
+  r->sqmask  = (unsigned int *) ((char *) r->sqring + p.sq_off.ring_mask);
+  r->sqarray = (unsigned int *) ((char *) r->sqring + p.sq_off.array);
+
+  r->cqhead  = (unsigned int *) ((char *) r->cqring + p.cq_off.head);
+  r->cqtail  = (unsigned int *) ((char *) r->cqring + p.cq_off.tail);
+  r->cqmask  = (unsigned int *) ((char *) r->cqring + p.cq_off.ring_mask);
+  r->cqes    = (struct io_uring_cqe *) ((char *) r->cqring + p.cq_off.cqes);
+
+  return r;
+}
+# endif
+
 /*
  * NAME:	os->open()
  * DESCRIPTION:	open and lock a new descriptor from the given path and mode
@@ -46,6 +192,7 @@ int os_open(void **priv, const char *path, int mode)
 {
   int fd;
   struct flock lock;
+  medium *m;
 
   switch (mode)
     {
@@ -74,7 +221,22 @@ int os_open(void **priv, const char *path, int mode)
       (errno == EACCES || errno == EAGAIN))
     ERROR(EAGAIN, "unable to obtain lock for medium");
 
-  *priv = (void *) (intptr_t) fd;
+  m = ALLOC(medium, 1);
+  if (m == 0)
+    ERROR(ENOMEM, 0);
+
+  m->fd    = fd;
+  m->map   = 0;
+  m->mapsz = 0;
+
+# ifdef USE_IO_URING
+  /* set up now, so that concurrent transfers never race to create it */
+
+  m->ring   = newring();
+  m->noring = 0;
+# endif
+
+  *priv = m;
 
   return 0;
 
@@ -89,11 +251,22 @@ fail:
  * NAME:	os->close()
  * DESCRIPTION:	close an open descriptor
  */
-int os_close(void **priv)
+int os_close(void *priv)
 {
-  int fd = (int) (intptr_t) *priv;
+  medium *m = priv;
+  int fd = m->fd;
+
+# ifdef USE_MMAP
+  if (m->map)
+    munmap(m->map, (size_t) m->mapsz << HFS_BLOCKSZ_BITS);
+# endif
+
+# ifdef USE_IO_URING
+  if (m->ring)
+    freering(m->ring);
+# endif
 
-  *priv = (void *) (intptr_t) -1;
+  FREE(m);
 
   if (close(fd) == -1)
     ERROR(errno, "error closing medium");
@@ -108,9 +281,9 @@ fail:
  * NAME:	os->same()
  * DESCRIPTION:	return 1 iff path is same as the open descriptor
  */
-int os_same(void **priv, const char *path)
+int os_same(void *priv, const char *path)
 {
-  int fd = (int) (intptr_t) *priv;
+  int fd = FD(priv);
   struct stat fdev, dev;
 
   if (fstat(fd, &fdev) == -1 ||
@@ -128,9 +301,9 @@ fail:
  * NAME:	os->seek()
  * DESCRIPTION:	set a descriptor's seek pointer (offset in blocks)
  */
-unsigned long os_seek(void **priv, unsigned long offset)
+unsigned long os_seek(void *priv, unsigned long offset)
 {
-  int fd = (int) (intptr_t) *priv;
+  int fd = FD(priv);
   off_t result;
 
   /* offset == -1 special; seek to last block of device */
@@ -149,13 +322,38 @@ fail:
   return -1;
 }
 
+/*
+ * NAME:	os->size()
+ * DESCRIPTION:	return the size of a medium in blocks (or 0 if unknown)
+ */
+unsigned long os_size(void *priv)
+{
+  int fd = FD(priv);
+  struct stat st;
+  off_t result;
+
+  if (fstat(fd, &st) == -1)
+    return 0;
+
+  if (S_ISREG(st.st_mode))
+    return (unsigned long) (st.st_size >> HFS_BLOCKSZ_BITS);
+
+  /* devices report no size through fstat() */
+
+  result = lseek(fd, 0, SEEK_END);
+  if (result == -1)
+    return 0;
+
+  return (unsigned long) (result >> HFS_BLOCKSZ_BITS);
+}
+
 /*
  * NAME:	os->read()
  * DESCRIPTION:	read blocks from an open descriptor
  */
-unsigned long os_read(void **priv, void *buf, unsigned long len)
+unsigned long os_read(void *priv, void *buf, unsigned long len)
 {
-  int fd = (int) (intptr_t) *priv;
+  int fd = FD(priv);
   ssize_t result;
 
   result = read(fd, buf, len << HFS_BLOCKSZ_BITS);
@@ -173,12 +371,70 @@ fail:
  * NAME:	os->write()
  * DESCRIPTION:	write blocks to an open descriptor
  */
-unsigned long os_write(void **priv, const void *buf, unsigned long len)
+unsigned long os_write(void *priv, const void *buf, unsigned long len)
+{
+  int fd = FD(priv);
+  ssize_t result;
+
+  result = write(fd, buf, len << HFS_BLOCKSZ_BITS);
+
+  if (result == -1)
+    ERROR(errno, "error writing to medium");
+
+  return (unsigned long) result >> HFS_BLOCKSZ_BITS;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	os->pread()
+ * DESCRIPTION:	read blocks from an open descriptor at an offset (in blocks)
+ */
+unsigned long os_pread(void *priv, void *buf, unsigned long len,
+		       unsigned long offset)
+{
+  int fd = FD(priv);
+  ssize_t result;
+
+# ifdef HAVE_PREAD
+  result = pread(fd, buf, len << HFS_BLOCKSZ_BITS,
+		 (off_t) offset << HFS_BLOCKSZ_BITS);
+# else
+  if (lseek(fd, (off_t) offset << HFS_BLOCKSZ_BITS, SEEK_SET) == -1)
+    ERROR(errno, "error seeking medium");
+
+  result = read(fd, buf, len << HFS_BLOCKSZ_BITS);
+# endif
+
+  if (result == -1)
+    ERROR(errno, "error reading from medium");
+
+  return (unsigned long) result >> HFS_BLOCKSZ_BITS;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	os->pwrite()
+ * DESCRIPTION:	write blocks to an open descriptor at an offset (in blocks)
+ */
+unsigned long os_pwrite(void *priv, const void *buf, unsigned long len,
+			unsigned long offset)
 {
-  int fd = (int) (intptr_t) *priv;
+  int fd = FD(priv);
   ssize_t result;
 
+# ifdef HAVE_PWRITE
+  result = pwrite(fd, buf, len << HFS_BLOCKSZ_BITS,
+		  (off_t) offset << HFS_BLOCKSZ_BITS);
+# else
+  if (lseek(fd, (off_t) offset << HFS_BLOCKSZ_BITS, SEEK_SET) == -1)
+    ERROR(errno, "error seeking medium");
+
   result = write(fd, buf, len << HFS_BLOCKSZ_BITS);
+# endif
 
   if (result == -1)
     ERROR(errno, "error writing to medium");
@@ -188,3 +444,352 @@ unsigned long os_write(void **priv, const void *buf, unsigned long len)
 fail:
   return -1;
 }
+
+/*
+ * NAME:	os->map()
+ * DESCRIPTION:	map an entire medium read-only; return 0 if not possible
+ */
+const void *os_map(void *priv, unsigned long *len)
+{
+# ifdef USE_MMAP
+  medium *m = priv;
+  struct stat st;
+  void *map;
+
+  if (m->map)
+    goto done;
+
+  /* only regular files small enough for the address space are mapped */
+
+  if (fstat(m->fd, &st) == -1 ||
+      ! S_ISREG(st.st_mode) ||
+      st.st_size < HFS_BLOCKSZ ||
+      (off_t) (size_t) st.st_size != st.st_size)
+    return 0;
+
+  m->mapsz = (unsigned long) (st.st_size >> HFS_BLOCKSZ_BITS);
+
+  map = mmap(0, (size_t) m->mapsz << HFS_BLOCKSZ_BITS,
+	     PROT_READ, MAP_SHARED, m->fd, 0);
+  if (map == MAP_FAILED)
+    return 0;
+
+  m->map = map;
+
+done:
+  *len = m->mapsz;
+
+  return m->map;
+# else
+  (void) priv;
+  (void) len;
+
+  return 0;
+# endif
+}
+
+# define IOVSZ	256
+
+/*
+ * NAME:	makeiov()
+ * DESCRIPTION:	build an I/O vector from block buffers, merging adjacent ones
+ */
+static
+int makeiov(struct iovec *iov, const void *const bufs[], unsigned long *len)
+{
+  unsigned long i;
+  int n = 0;
+
+  for (i = 0; i < *len; ++i)
+    {
+      const char *buf = bufs[i];
+
+      if (n > 0 &&
+	  (const char *) iov[n - 1].iov_base + iov[n - 1].iov_len == buf)
+	iov[n - 1].iov_len += HFS_BLOCKSZ;
+      else if (n < IOVSZ)
+	{
+	  iov[n].iov_base = (void *) buf;
+	  iov[n].iov_len  = HFS_BLOCKSZ;
+	  ++n;
+	}
+      else
+	break;
+    }
+
+  *len = i;
+
+  return n;
+}
+
+/*
+ * NAME:	os->preadv()
+ * DESCRIPTION:	read blocks at an offset (in blocks) into scattered buffers
+ */
+unsigned long os_preadv(void *priv, void *const bufs[], unsigned long len,
+			unsigned long offset)
+{
+  int fd = FD(priv);
+  struct iovec iov[IOVSZ];
+  unsigned long count, total = 0;
+  ssize_t result;
+  int n;
+
+# ifndef HAVE_PREADV
+  if (lseek(fd, (off_t) offset << HFS_BLOCKSZ_BITS, SEEK_SET) == -1)
+    ERROR(errno, "error seeking medium");
+# endif
+
+  while (total < len)
+    {
+      count = len - total;
+      n     = makeiov(iov, (const void *const *) bufs + total, &count);
+
+# ifdef HAVE_PREADV
+      result = preadv(fd, iov, n,
+		      (off_t) (offset + total) << HFS_BLOCKSZ_BITS);
+# else
+      result = readv(fd, iov, n);
+# endif
+
+      if (result == -1)
+	ERROR(errno, "error reading from medium");
+
+      total += (unsigned long) result >> HFS_BLOCKSZ_BITS;
+
+      if ((unsigned long) result != count << HFS_BLOCKSZ_BITS)
+	break;
+    }
+
+  return total;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	os->pwritev()
+ * DESCRIPTION:	write blocks at an offset (in blocks) from scattered buffers
+ */
+unsigned long os_pwritev(void *priv, const void *const bufs[],
+			 unsigned long len, unsigned long offset)
+{
+  int fd = FD(priv);
+  struct iovec iov[IOVSZ];
+  unsigned long count, total = 0;
+  ssize_t result;
+  int n;
+
+# ifndef HAVE_PWRITEV
+  if (lseek(fd, (off_t) offset << HFS_BLOCKSZ_BITS, SEEK_SET) == -1)
+    ERROR(errno, "error seeking medium");
+# endif
+
+  while (total < len)
+    {
+      count = len - total;
+      n     = makeiov(iov, bufs + total, &count);
+
+# ifdef HAVE_PWRITEV
+      result = pwritev(fd, iov, n,
+		       (off_t) (offset + total) << HFS_BLOCKSZ_BITS);
+# else
+      result = writev(fd, iov, n);
+# endif
+
+      if (result == -1)
+	ERROR(errno, "error writing to medium");
+
+      total += (unsigned long) result >> HFS_BLOCKSZ_BITS;
+
+      if ((unsigned long) result != count << HFS_BLOCKSZ_BITS)
+	break;
+    }
+
+  return total;
+
+fail:
+  return -1;
+}
+
+# ifdef USE_IO_URING
+/*
+ * NAME:	ringbatch()
+ * DESCRIPTION:	perform a batch of transfers through an asynchronous I/O ring
+ *
+ * Returns the number of leading requests completed; the caller performs
+ * the rest synchronously. Every request submitted to the kernel is reaped
+ * before returning, so no transfer is left in flight.
+ */
+static
+unsigned int ringbatch(medium *m, hfsioreq *reqs, unsigned int n)
+{
+  ring *r = m->ring;
+  struct iovec *iov;
+  unsigned long total, pos, *want;
+  unsigned int i, first, queued, submitted, reaped, start, tail, head;
+  long result;
+
+  for (total = 0, i = 0; i < n; ++i)
+    total += reqs[i].len;
+
+  iov  = ALLOC(struct iovec, total);
+  want = ALLOC(unsigned long, n);
+  if (iov == 0 || want == 0)
+    {
+      FREE(want);
+      FREE(iov);
+
+      return 0;
+    }
+
+  for (pos = 0, first = 0; first < n; first += submitted)
+    {
+      /* queue as many requests as the ring will hold */
+
+      start = tail = *r->sqtail;
+
+      for (queued = 0; queued < r->entries && first + queued < n; ++queued)
+	{
+	  hfsioreq *req = &reqs[first + queued];
+	  struct io_uring_sqe *sqe;
+	  unsigned int index;
+	  int niov;
+
+	  want[first + queued] = req->len;
+	  niov = makeiov(iov + pos, (const void *const *) req->bufs,
+			 &want[first + queued]);
+
+	  index = tail++ & *r->sqmask;
+	  sqe   = &r->sqes[index];
+
+	  memset(sqe, 0, sizeof(*sqe));
+
+	  sqe->opcode    = req->write ? IORING_OP_WRITEV : IORING_OP_READV;
+	  sqe->fd        = m->fd;
+	  sqe->addr      = (unsigned long) (iov + pos);
+	  sqe->len       = niov;
+	  sqe->off       = (off_t) req->bnum << HFS_BLOCKSZ_BITS;
+	  sqe->user_data = first + queued;
+
+	  r->sqarray[index] = index;
+
+	  pos += niov;
+	}
+
+      __atomic_store_n(r->sqtail, tail, __ATOMIC_RELEASE);
+
+      result = syscall(__NR_io_uring_enter, r->fd, queued, queued,
+		       IORING_ENTER_GETEVENTS, 0, 0);
+
+      /* the kernel's head tells how many entries it actually consumed;
+	 withdraw the rest so a later call does not submit them */
+
+      submitted = __atomic_load_n(r->sqhead, __ATOMIC_ACQUIRE) - start;
+      if (submitted < queued)
+	__atomic_store_n(r->sqtail, start + submitted, __ATOMIC_RELEASE);
+
+      /* collect the completions of everything submitted */
+
+      for (reaped = 0; reaped < submitted; )
+	{
+	  struct io_uring_cqe *cqe;
+	  hfsioreq *req;
+
+	  head = *r->cqhead;
+
+	  if (head == __atomic_load_n(r->cqtail, __ATOMIC_ACQUIRE))
+	    {
+	      /* the buffers must outlive the transfers, so keep waiting
+		 even if waiting itself fails */
+
+	      syscall(__NR_io_uring_enter, r->fd, 0, submitted - reaped,
+		      IORING_ENTER_GETEVENTS, 0, 0);
+
+	      continue;
+	    }
+
+	  cqe = &r->cqes[head & *r->cqmask];
+	  req = &reqs[cqe->user_data];
+
+	  if (cqe->res < 0)
+	    {
+	      req->count = -1;
+
+	      hfs_error = req->write ?
+		"error writing to medium" : "error reading from medium";
+	      errno = -cqe->res;
+	    }
+	  else
+	    req->count = (unsigned long) cqe->res >> HFS_BLOCKSZ_BITS;
+
+	  __atomic_store_n(r->cqhead, head + 1, __ATOMIC_RELEASE);
+	  ++reaped;
+	}
+
+      /* finish synchronously anything that did not fit one I/O vector */
+
+      for (i = first; i < first + submitted; ++i)
+	{
+	  hfsioreq *req = &reqs[i];
+	  unsigned long count;
+
+	  if (req->count != want[i] || want[i] == req->len)
+	    continue;
+
+	  if (req->write)
+	    count = os_pwritev(m, (const void *const *) req->bufs + want[i],
+			       req->len - want[i], req->bnum + want[i]);
+	  else
+	    count = os_preadv(m, req->bufs + want[i],
+			      req->len - want[i], req->bnum + want[i]);
+
+	  req->count = (count == (unsigned long) -1) ? count : want[i] + count;
+	}
+
+      if (submitted < queued)
+	{
+	  /* a ring that refuses work outright is not worth trying again */
+
+	  if (result == -1 && errno != EINTR && errno != EAGAIN &&
+	      errno != EBUSY)
+	    m->noring = 1;
+
+	  first += submitted;
+	  break;
+	}
+    }
+
+  FREE(want);
+  FREE(iov);
+
+  return first;
+}
+# endif
+
+/*
+ * NAME:	os->batch()
+ * DESCRIPTION:	perform a batch of transfers, asynchronously if possible
+ */
+int os_batch(void *priv, hfsioreq *reqs, unsigned int n)
+{
+  medium *m = priv;
+  unsigned int i = 0;
+
+# ifdef USE_IO_URING
+  if (m->ring && ! m->noring)
+    i = ringbatch(m, reqs, n);
+# endif
+
+  for ( ; i < n; ++i)
+    {
+      if (reqs[i].write)
+	reqs[i].count = os_pwritev(m, (const void *const *) reqs[i].bufs,
+				   reqs[i].len, reqs[i].bnum);
+      else
+	reqs[i].count = os_preadv(m, reqs[i].bufs,
+				  reqs[i].len, reqs[i].bnum);
+    }
+
+  return 0;
+}
@@ -124,6 +124,54 @@ int r_compareextkeys(const ExtKeyRec *key1, const ExtKeyRec *key2)
   return key1->xkrFABN - key2->xkrFABN;
 }
 
+/*
+ * NAME:	record->comparecatpkeys()
+ * DESCRIPTION:	compare two packed catalog record keys without unpacking
+ */
+int r_comparecatpkeys(const byte *pkey1, const byte *pkey2)
+{
+  unsigned long id1, id2;
+  unsigned int len1, len2;
+
+  id1 = d_getul(pkey1 + 2);
+  id2 = d_getul(pkey2 + 2);
+
+  if (id1 != id2)
+    return id1 < id2 ? -1 : 1;
+
+  /* names too long to unpack compare as empty */
+
+  len1 = pkey1[6];
+  if (len1 > HFS_MAX_FLEN)
+    len1 = 0;
+
+  len2 = pkey2[6];
+  if (len2 > HFS_MAX_FLEN)
+    len2 = 0;
+
+  return d_relpstring(pkey1 + 7, len1, pkey2 + 7, len2);
+}
+
+/*
+ * NAME:	record->compareextpkeys()
+ * DESCRIPTION:	compare two packed extents record keys without unpacking
+ */
+int r_compareextpkeys(const byte *pkey1, const byte *pkey2)
+{
+  unsigned long fnum1, fnum2;
+
+  fnum1 = d_getul(pkey1 + 2);
+  fnum2 = d_getul(pkey2 + 2);
+
+  if (fnum1 != fnum2)
+    return fnum1 < fnum2 ? -1 : 1;
+
+  if (pkey1[1] != pkey2[1])
+    return (int) pkey1[1] - (int) pkey2[1];
+
+  return (int) d_getuw(pkey1 + 6) - (int) d_getuw(pkey2 + 6);
+}
+
 /*
  * NAME:	record->packcatdata()
  * DESCRIPTION:	pack catalog record data
@@ -555,3 +603,77 @@ void r_unpackdirent(unsigned long parid, const char *name,
       break;
     }
 }
+
+/*
+ * NAME:	record->unpackpdirent()
+ * DESCRIPTION:	unpack selected fields of a packed catalog record into hfsdirent
+ */
+void r_unpackpdirent(const byte *prec, int fields, hfsdirent *ent)
+{
+  const byte *pkey = prec + 2, *pdata = HFS_RECDATA(prec);
+
+  d_fetchul(&pkey, &ent->parid);
+  d_fetchstr(&pkey, ent->name, sizeof(ent->name));
+
+  switch ((signed char) pdata[0])
+    {
+    case cdrDirRec:
+      ent->flags = HFS_ISDIR;
+      ent->cnid  = d_getul(pdata + 6);
+
+      if (fields & HFS_DIRENT_DATES)
+	{
+	  ent->crdate = d_ltime(d_getul(pdata + 10));
+	  ent->mddate = d_ltime(d_getul(pdata + 14));
+	  ent->bkdate = d_ltime(d_getul(pdata + 18));
+	}
+
+      if (fields & HFS_DIRENT_FINDER)
+	{
+	  ent->u.dir.rect.top    = d_getsw(pdata + 22);
+	  ent->u.dir.rect.left   = d_getsw(pdata + 24);
+	  ent->u.dir.rect.bottom = d_getsw(pdata + 26);
+	  ent->u.dir.rect.right  = d_getsw(pdata + 28);
+
+	  ent->fdflags      = d_getsw(pdata + 30);
+	  ent->fdlocation.v = d_getsw(pdata + 32);
+	  ent->fdlocation.h = d_getsw(pdata + 34);
+	}
+
+      if (fields & HFS_DIRENT_SIZES)
+	ent->u.dir.valence = d_getuw(pdata + 4);
+
+      break;
+
+    case cdrFilRec:
+      ent->flags = (pdata[2] & (1 << 0)) ? HFS_ISLOCKED : 0;
+      ent->cnid  = d_getul(pdata + 20);
+
+      if (fields & HFS_DIRENT_DATES)
+	{
+	  ent->crdate = d_ltime(d_getul(pdata + 44));
+	  ent->mddate = d_ltime(d_getul(pdata + 48));
+	  ent->bkdate = d_ltime(d_getul(pdata + 52));
+	}
+
+      if (fields & HFS_DIRENT_FINDER)
+	{
+	  memcpy(ent->u.file.type,    pdata + 4, 4);
+	  memcpy(ent->u.file.creator, pdata + 8, 4);
+
+	  ent->u.file.type[4] = ent->u.file.creator[4] = 0;
+
+	  ent->fdflags      = d_getsw(pdata + 12);
+	  ent->fdlocation.v = d_getsw(pdata + 14);
+	  ent->fdlocation.h = d_getsw(pdata + 16);
+	}
+
+      if (fields & HFS_DIRENT_SIZES)
+	{
+	  ent->u.file.dsize = d_getul(pdata + 26);
+	  ent->u.file.rsize = d_getul(pdata + 36);
+	}
+
+      break;
+    }
+}
@@ -0,0 +1,143 @@
+/*
+ * libhfs - library for reading and writing Macintosh HFS volumes
+ * Copyright (C) 1996-1998 Robert Leslie
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * $Id$
+ */
+
+/*
+ * B*-tree search routines, generated once for each kind of key comparison.
+ * Before including this file, define:
+ *
+ *   NSEARCH			name of the node search routine
+ *   BTSEARCH			name of the tree search routine (optional)
+ *   KEYCOMPARE(np, rec, key)	comparison of a packed record key with a
+ *				packed search key; if not defined, NSEARCH
+ *				must already exist and is not generated
+ *   NSEARCH_SCOPE		storage class for the node search routine
+ *
+ * The generated routines behave exactly as n_search() and bt_search().
+ */
+
+# ifdef KEYCOMPARE
+/*
+ * NAME:	NSEARCH()
+ * DESCRIPTION:	locate a record in a node, or the record it should follow
+ */
+NSEARCH_SCOPE
+int NSEARCH(node *np, const byte *pkey)
+{
+  int lo, hi, mid, i, rnum = -1, comp = -1;
+
+  /* binary search for the last record whose key does not exceed pkey */
+
+  lo = 0;
+  hi = np->nd.ndNRecs;
+
+  while (lo < hi)
+    {
+      int diff;
+
+      mid = (lo + hi) >> 1;
+
+      for (i = mid; i >= lo && HFS_RECKEYLEN(HFS_NODEREC(*np, i)) == 0; --i)
+	;  /* skip deleted records */
+
+      if (i < lo)
+	{
+	  lo = mid + 1;
+	  continue;
+	}
+
+      diff = KEYCOMPARE(np, HFS_NODEREC(*np, i), pkey);
+
+      if (diff <= 0)
+	{
+	  rnum = i;
+	  comp = diff;
+	  lo   = mid + 1;
+	}
+      else
+	hi = i;
+    }
+
+  np->rnum = rnum;
+
+  return comp == 0;
+}
+# endif
+
+# ifdef BTSEARCH
+/*
+ * NAME:	BTSEARCH()
+ * DESCRIPTION:	locate a data record given a search key
+ */
+int BTSEARCH(btree *bt, const byte *key, node *np)
+{
+  int found = 0;
+  unsigned long nnum;
+
+  nnum = bt->hdr.bthRoot;
+
+  if (nnum == 0)
+    ERROR(ENOENT, 0);
+
+  while (1)
+    {
+      const byte *rec;
+
+      if (bt_getnode(np, bt, nnum) == -1)
+	{
+	  found = -1;
+	  goto fail;
+	}
+
+      found = NSEARCH(np, key);
+
+      switch (np->nd.ndType)
+	{
+	case ndIndxNode:
+	  if (np->rnum == -1)
+	    ERROR(ENOENT, 0);
+
+	  rec  = HFS_NODEREC(*np, np->rnum);
+	  nnum = d_getul(HFS_RECDATA(rec));
+
+	  break;
+
+	case ndLeafNode:
+	  if (! found)
+	    ERROR(ENOENT, 0);
+
+	  goto done;
+
+	default:
+	  found = -1;
+	  ERROR(EIO, "unexpected b*-tree node");
+	}
+    }
+
+done:
+fail:
+  return found;
+}
+# endif
+
+# undef NSEARCH
+# undef BTSEARCH
+# undef KEYCOMPARE
+# undef NSEARCH_SCOPE
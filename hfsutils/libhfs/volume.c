@@ -37,6 +37,8 @@
 # include "file.h"
 # include "btree.h"
 # include "record.h"
+# include "bitmap.h"
+# include "freemap.h"
 # include "os.h"
 
 /*
@@ -48,9 +50,14 @@ void v_init(hfsvol *vol, int flags)
   btree *ext = &vol->ext;
   btree *cat = &vol->cat;
 
+  memset(&vol->io, 0, sizeof(vol->io));
+
   vol->priv       = 0;
   vol->flags      = flags & HFS_VOL_OPT_MASK;
 
+  vol->map        = 0;
+  vol->mapsz      = 0;
+
   vol->pnum       = -1;
   vol->vstart     = 0;
   vol->vlen       = 0;
@@ -60,6 +67,15 @@ void v_init(hfsvol *vol, int flags)
 
   vol->vbm        = 0;
   vol->vbmsz      = 0;
+  vol->vbmload    = 0;
+  vol->vbmlo      = 0;
+  vol->vbmhi      = 0;
+  vol->fmap       = 0;
+
+  vol->dcache     = 0;
+
+  LOCKINIT(vol->lock);
+  LOCKINIT(vol->dlock);
 
   f_init(&ext->f, vol, HFS_CNID_EXT, "extents overflow");
 
@@ -67,8 +83,13 @@ void v_init(hfsvol *vol, int flags)
   ext->mapsz      = 0;
   ext->flags      = 0;
 
-  ext->keyunpack  = (keyunpackfunc)  r_unpackextkey;
-  ext->keycompare = (keycomparefunc) r_compareextkeys;
+  ext->keycompare = r_compareextpkeys;
+
+  LOCKINIT(ext->lock);
+
+  ext->ncache     = 0;
+  ext->nhits      = 0;
+  ext->nmisses    = 0;
 
   f_init(&cat->f, vol, HFS_CNID_CAT, "catalog");
 
@@ -76,8 +97,13 @@ void v_init(hfsvol *vol, int flags)
   cat->mapsz      = 0;
   cat->flags      = 0;
 
-  cat->keyunpack  = (keyunpackfunc)  r_unpackcatkey;
-  cat->keycompare = (keycomparefunc) r_comparecatkeys;
+  cat->keycompare = r_comparecatpkeys;
+
+  LOCKINIT(cat->lock);
+
+  cat->ncache     = 0;
+  cat->nhits      = 0;
+  cat->nmisses    = 0;
 
   vol->cwd        = HFS_CNID_ROOTDIR;
 
@@ -95,18 +121,49 @@ void v_init(hfsvol *vol, int flags)
  */
 int v_open(hfsvol *vol, const char *path, int mode)
 {
+  void *priv;
+
   if (vol->flags & HFS_VOL_OPEN)
     ERROR(EINVAL, "volume already open");
 
-  if (os_open(&vol->priv, path, mode) == -1)
+  if (os_open(&priv, path, mode) == -1)
+    goto fail;
+
+  if (v_openio(vol, priv, &os_procs, mode) == -1)
     goto fail;
 
+  vol->flags |= HFS_VOL_OSMEDIUM;
+
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	vol->openio()
+ * DESCRIPTION:	attach a volume to a medium accessed through given procedures
+ */
+int v_openio(hfsvol *vol, void *priv, const struct hfsioprocs *procs,
+	     int mode)
+{
+  if (vol->flags & HFS_VOL_OPEN)
+    ERROR(EINVAL, "volume already open");
+
+  vol->io    = *procs;
+  vol->priv  = priv;
+
   vol->flags |= HFS_VOL_OPEN;
 
-  /* initialize volume block cache (OK to fail) */
+  /* read-only media are mapped into memory if possible */
+
+  if (mode == HFS_MODE_RDONLY && vol->io.map)
+    vol->map = vol->io.map(vol->priv, &vol->mapsz);
 
-  if (! (vol->flags & HFS_OPT_NOCACHE) &&
-      b_init(vol) != -1)
+  /* initialize volume block cache (OK to fail, and unneeded if mapped) */
+
+  if (! (vol->flags & HFS_OPT_NOCACHE) && vol->map == 0 &&
+      b_init(vol, HFS_CACHESZ) != -1)
     vol->flags |= HFS_VOL_USINGCACHE;
 
   return 0;
@@ -192,17 +249,29 @@ int v_close(hfsvol *vol)
       b_finish(vol) == -1)
     result = -1;
 
-  if (os_close(&vol->priv) == -1)
+  /* any mapping of the medium belongs to its access procedures */
+
+  vol->map   = 0;
+  vol->mapsz = 0;
+
+  if (vol->io.close && vol->io.close(vol->priv) == -1)
     result = -1;
 
-  vol->flags &= ~(HFS_VOL_OPEN | HFS_VOL_MOUNTED | HFS_VOL_USINGCACHE);
+  vol->priv = 0;
+
+  vol->flags &= ~(HFS_VOL_OPEN | HFS_VOL_MOUNTED | HFS_VOL_USINGCACHE |
+		  HFS_VOL_OSMEDIUM);
 
   /* free dynamically allocated structures */
 
   FREE(vol->vbm);
+  FREE(vol->vbmload);
+
+  vol->vbm     = 0;
+  vol->vbmsz   = 0;
+  vol->vbmload = 0;
 
-  vol->vbm   = 0;
-  vol->vbmsz = 0;
+  fm_free(vol);
 
   FREE(vol->ext.map);
   FREE(vol->cat.map);
@@ -210,6 +279,16 @@ int v_close(hfsvol *vol)
   vol->ext.map = 0;
   vol->cat.map = 0;
 
+  f_freemap(&vol->ext.f);
+  f_freemap(&vol->cat.f);
+
+  bt_freecache(&vol->ext);
+  bt_freecache(&vol->cat);
+
+  FREE(vol->dcache);
+
+  vol->dcache = 0;
+
 done:
   return result;
 }
@@ -220,7 +299,12 @@ done:
  */
 int v_same(hfsvol *vol, const char *path)
 {
-  return os_same(&vol->priv, path);
+  /* only media opened by path have an identity to compare */
+
+  if (! (vol->flags & HFS_VOL_OSMEDIUM))
+    return 0;
+
+  return os_same(vol->priv, path);
 }
 
 /*
@@ -362,56 +446,107 @@ fail:
 }
 
 /*
- * NAME:	vol->readvbm()
- * DESCRIPTION:	read volume bitmap into memory
+ * NAME:	vol->loadvbm()
+ * DESCRIPTION:	read the parts of the volume bitmap covering a block range
  */
-int v_readvbm(hfsvol *vol)
+int v_loadvbm(hfsvol *vol, unsigned int start, unsigned int end)
 {
-  unsigned int vbmst = vol->mdb.drVBMSt;
-  unsigned int vbmsz = (vol->mdb.drNmAlBlks + 0x0fff) >> 12;
-  block *bp;
-
-  ASSERT(vol->vbm == 0);
+  unsigned int vbmsz = vol->vbmsz;
+  unsigned int i, last, len;
 
-  if (vol->mdb.drAlBlSt - vbmst < vbmsz)
-    ERROR(EIO, "volume bitmap collides with volume data");
+  if (vol->vbm && vol->vbmload == 0)
+    return 0;
 
-  vol->vbm = ALLOC(block, vbmsz);
   if (vol->vbm == 0)
-    ERROR(ENOMEM, 0);
+    {
+      vol->vbmload = ALLOC(byte, vbmsz);
+      if (vol->vbmload == 0)
+	ERROR(ENOMEM, 0);
+
+      vol->vbm = ALLOC(block, vbmsz);
+      if (vol->vbm == 0)
+	{
+	  FREE(vol->vbmload);
+	  vol->vbmload = 0;
+
+	  ERROR(ENOMEM, 0);
+	}
+
+      memset(vol->vbmload, 0, vbmsz);
+    }
+
+  if (end > vol->mdb.drNmAlBlks)
+    end = vol->mdb.drNmAlBlks;
+
+  if (start >= end)
+    return 0;
+
+  /* read each run of missing bitmap blocks at once */
 
-  vol->vbmsz = vbmsz;
+  last = HFS_VBMBLOCK(end - 1);
 
-  for (bp = vol->vbm; vbmsz--; ++bp)
+  for (i = HFS_VBMBLOCK(start); i <= last; i += len)
     {
-      if (b_readlb(vol, vbmst++, bp) == -1)
+      for (len = 0; i + len <= last && ! vol->vbmload[i + len]; ++len)
+	;
+
+      if (len == 0)
+	{
+	  len = 1;
+	  continue;
+	}
+
+      if (b_readlbn(vol, vol->mdb.drVBMSt + i, &vol->vbm[i], len) == -1)
 	goto fail;
+
+      memset(&vol->vbmload[i], 1, len);
     }
 
-  return 0;
+  /* once every block is present, stop tracking them */
 
-fail:
-  FREE(vol->vbm);
+  for (i = 0; i < vbmsz && vol->vbmload[i]; ++i)
+    ;
 
-  vol->vbm   = 0;
-  vol->vbmsz = 0;
+  if (i == vbmsz)
+    {
+      FREE(vol->vbmload);
+      vol->vbmload = 0;
+    }
 
+  return 0;
+
+fail:
   return -1;
 }
 
+/*
+ * NAME:	vol->readvbm()
+ * DESCRIPTION:	read the whole volume bitmap into memory
+ */
+int v_readvbm(hfsvol *vol)
+{
+  return v_loadvbm(vol, 0, vol->mdb.drNmAlBlks);
+}
+
 /*
  * NAME:	vol->writevbm()
  * DESCRIPTION:	flush volume bitmap to medium
  */
 int v_writevbm(hfsvol *vol)
 {
-  unsigned int vbmst = vol->mdb.drVBMSt;
-  unsigned int vbmsz = vol->vbmsz;
-  const block *bp;
+  unsigned int i;
+
+  ASSERT(vol->vbmhi <= vol->vbmsz);
+
+  /* the changed range may span blocks never read; those are unchanged
+     on the medium and must not be overwritten */
 
-  for (bp = vol->vbm; vbmsz--; ++bp)
+  for (i = vol->vbmlo; i < vol->vbmhi; ++i)
     {
-      if (b_writelb(vol, vbmst++, bp) == -1)
+      if (vol->vbmload && ! vol->vbmload[i])
+	continue;
+
+      if (b_writelb(vol, vol->mdb.drVBMSt + i, &vol->vbm[i]) == -1)
 	goto fail;
     }
 
@@ -423,17 +558,55 @@ fail:
   return -1;
 }
 
+/*
+ * NAME:	vol->dirtyvbm()
+ * DESCRIPTION:	note that a range of bits in the volume bitmap has changed
+ */
+void v_dirtyvbm(hfsvol *vol, unsigned int start, unsigned int end)
+{
+  unsigned int lo, hi;
+
+  if (start >= end)
+    return;
+
+  lo = HFS_VBMBLOCK(start);
+  hi = HFS_VBMBLOCK(end - 1) + 1;
+
+  if (! (vol->flags & HFS_VOL_UPDATE_VBM))
+    {
+      vol->vbmlo = lo;
+      vol->vbmhi = hi;
+    }
+  else
+    {
+      if (lo < vol->vbmlo)
+	vol->vbmlo = lo;
+      if (hi > vol->vbmhi)
+	vol->vbmhi = hi;
+    }
+
+  vol->flags |= HFS_VOL_UPDATE_VBM;
+}
+
 /*
  * NAME:	vol->mount()
  * DESCRIPTION:	load volume information into memory
  */
 int v_mount(hfsvol *vol)
 {
-  /* read the MDB, volume bitmap, and extents/catalog B*-tree headers */
+  /* read the MDB and extents/catalog B*-tree headers */
+
+  if (v_readmdb(vol) == -1)
+    goto fail;
 
-  if (v_readmdb(vol) == -1 ||
-      v_readvbm(vol) == -1 ||
-      bt_readhdr(&vol->ext) == -1 ||
+  /* the volume bitmap is read later, only as allocation requires it */
+
+  vol->vbmsz = (vol->mdb.drNmAlBlks + 0x0fff) >> 12;
+
+  if (vol->mdb.drAlBlSt - vol->mdb.drVBMSt < vol->vbmsz)
+    ERROR(EIO, "volume bitmap collides with volume data");
+
+  if (bt_readhdr(&vol->ext) == -1 ||
       bt_readhdr(&vol->cat) == -1)
     goto fail;
 
@@ -481,6 +654,140 @@ fail:
   return -1;
 }
 
+/*
+ * NAME:	dhash()
+ * DESCRIPTION:	return the hash slot for a catalog key, ignoring case
+ */
+static
+unsigned int dhash(unsigned long parid, const char *name)
+{
+  unsigned long h = parid;
+
+  while (*name)
+    h = h * 31 + hfs_charorder[(unsigned char) *name++];
+
+  return h & (HFS_DCACHESZ - 1);
+}
+
+/*
+ * NAME:	dfind()
+ * DESCRIPTION:	locate a catalog key in the dentry cache, and/or its hash link
+ */
+static
+int *dfind(dcache *dc, unsigned long parid, const char *name, int index)
+{
+  int *dptr;
+
+  for (dptr = &dc->hash[dhash(parid, name)]; *dptr != -1;
+       dptr = &dc->ring[*dptr].hnext)
+    {
+      const dentry *d = &dc->ring[*dptr];
+
+      if (index >= 0 ? *dptr == index :
+	  (d->parid == parid && d_relstring(d->name, name) == 0))
+	break;
+    }
+
+  return dptr;
+}
+
+/*
+ * NAME:	dkeep()
+ * DESCRIPTION:	remember a catalog record found or stored under a key
+ */
+static
+void dkeep(hfsvol *vol, unsigned long parid, const char *name,
+	   const CatDataRec *data, int replace)
+{
+  dcache *dc;
+  dentry *d;
+  int *dptr, i;
+
+  LOCK(vol->dlock);
+
+  dc = vol->dcache;
+  if (dc == 0)
+    {
+      if (replace)
+	goto done;
+
+      dc = vol->dcache = ALLOC(dcache, 1);
+      if (dc == 0)
+	goto done;
+
+      for (i = 0; i < HFS_DCACHESZ; ++i)
+	{
+	  dc->ring[i].parid = 0;
+	  dc->ring[i].hnext = -1;
+	  dc->hash[i] = -1;
+	}
+
+      dc->pos = 0;
+    }
+
+  dptr = dfind(dc, parid, name, -1);
+  if (*dptr != -1)
+    {
+      d = &dc->ring[*dptr];
+      strcpy(d->name, name);
+      memcpy(&d->data, data, sizeof(CatDataRec));
+
+      goto done;
+    }
+  else if (replace)
+    goto done;
+
+  d = &dc->ring[dc->pos];
+
+  if (d->parid)
+    {
+      dptr  = dfind(dc, d->parid, d->name, dc->pos);
+      *dptr = d->hnext;
+    }
+
+  dptr = &dc->hash[dhash(parid, name)];
+
+  d->parid = parid;
+  strcpy(d->name, name);
+  memcpy(&d->data, data, sizeof(CatDataRec));
+
+  d->hnext = *dptr;
+  *dptr    = dc->pos;
+
+  dc->pos = (dc->pos + 1) % HFS_DCACHESZ;
+
+done:
+  UNLOCK(vol->dlock);
+}
+
+/*
+ * NAME:	vol->dpurge()
+ * DESCRIPTION:	forget any cached catalog record under a key about to be deleted
+ */
+void v_dpurge(hfsvol *vol, unsigned long parid, const char *name)
+{
+  dcache *dc;
+  int *dptr;
+
+  LOCK(vol->dlock);
+
+  dc = vol->dcache;
+  if (dc)
+    {
+      dptr = dfind(dc, parid, name, -1);
+      if (*dptr != -1)
+	{
+	  dentry *d = &dc->ring[*dptr];
+
+	  *dptr    = d->hnext;
+	  d->parid = 0;
+	  d->hnext = -1;
+	}
+    }
+
+  UNLOCK(vol->dlock);
+}
+
 /*
  * NAME:	vol->catsearch()
  * DESCRIPTION:	search catalog tree
@@ -489,31 +796,65 @@ int v_catsearch(hfsvol *vol, unsigned long parid, const char *name,
 		CatDataRec *data, char *cname, node *np)
 {
   CatKeyRec key;
+  CatDataRec rec;
   byte pkey[HFS_CATKEYLEN];
   const byte *ptr;
   node n;
   int found;
 
+  /* callers that want the node itself must search the tree */
+
   if (np == 0)
-    np = &n;
+    {
+      found = 0;
+
+      LOCK(vol->dlock);
+
+      if (vol->dcache)
+	{
+	  const int *dptr = dfind(vol->dcache, parid, name, -1);
+
+	  if (*dptr != -1)
+	    {
+	      const dentry *d = &vol->dcache->ring[*dptr];
+
+	      if (cname)
+		strcpy(cname, d->name);
+
+	      if (data)
+		memcpy(data, &d->data, sizeof(CatDataRec));
+
+	      found = 1;
+	    }
+	}
+
+      UNLOCK(vol->dlock);
+
+      if (found)
+	return 1;
+
+      np = &n;
+    }
 
   r_makecatkey(&key, parid, name);
   r_packcatkey(&key, pkey, 0);
 
-  found = bt_search(&vol->cat, pkey, np);
+  found = bt_searchcat(&vol->cat, pkey, np);
   if (found <= 0)
     return found;
 
   ptr = HFS_NODEREC(*np, np->rnum);
 
+  if (data == 0)
+    data = &rec;
+
+  r_unpackcatkey(ptr, &key);
+  r_unpackcatdata(HFS_RECDATA(ptr), data);
+
   if (cname)
-    {
-      r_unpackcatkey(ptr, &key);
-      strcpy(cname, key.ckrCName);
-    }
+    strcpy(cname, key.ckrCName);
 
-  if (data)
-    r_unpackcatdata(HFS_RECDATA(ptr), data);
+  dkeep(vol, key.ckrParID, key.ckrCName, data, 0);
 
   return 1;
 }
@@ -539,12 +880,12 @@ int v_extsearch(hfsfile *file, unsigned int fabn,
   r_makeextkey(&key, file->fork, file->cat.u.fil.filFlNum, fabn);
   r_packextkey(&key, pkey, 0);
 
-  /* in case bt_search() clobbers these */
+  /* in case bt_searchext() clobbers these */
 
   memcpy(&extsave, &file->ext, sizeof(ExtDataRec));
   fabnsave = file->fabn;
 
-  found = bt_search(&file->vol->ext, pkey, np);
+  found = bt_searchext(&file->vol->ext, pkey, np);
 
   memcpy(&file->ext, &extsave, sizeof(ExtDataRec));
   file->fabn = fabnsave;
@@ -590,6 +931,7 @@ fail:
  */
 int v_putcatrec(const CatDataRec *data, node *np)
 {
+  CatKeyRec key;
   byte pdata[HFS_CATDATALEN], *ptr;
   unsigned int len = 0;
 
@@ -598,6 +940,9 @@ int v_putcatrec(const CatDataRec *data, node *np)
   ptr = HFS_NODEREC(*np, np->rnum);
   memcpy(HFS_RECDATA(ptr), pdata, len);
 
+  r_unpackcatkey(ptr, &key);
+  dkeep(np->bt->f.vol, key.ckrParID, key.ckrCName, data, 1);
+
   return bt_putnode(np);
 }
 
@@ -619,35 +964,24 @@ int v_putextrec(const ExtDataRec *data, node *np)
 }
 
 /*
- * NAME:	vol->allocblocks()
- * DESCRIPTION:	allocate a contiguous range of blocks
+ * NAME:	scanblocks()
+ * DESCRIPTION:	search the bitmap for unused blocks; return count found
  */
-int v_allocblocks(hfsvol *vol, ExtDescriptor *blocks)
+static
+unsigned int scanblocks(hfsvol *vol, unsigned int start,
+			unsigned int request, unsigned int *foundat)
 {
-  unsigned int request, found, foundat, start, end;
+  unsigned int found = 0, end = vol->mdb.drNmAlBlks;
   register unsigned int pt;
-  block *vbm;
+  const byte *vbm = (const byte *) vol->vbm;
   int wrap = 0;
 
-  if (vol->mdb.drFreeBks == 0)
-    ERROR(ENOSPC, "volume full");
-
-  request = blocks->xdrNumABlks;
-  found   = 0;
-  foundat = 0;
-  start   = vol->mdb.drAllocPtr;
-  end     = vol->mdb.drNmAlBlks;
-  vbm     = vol->vbm;
-
-  ASSERT(request > 0);
+  *foundat = 0;
 
   /* backtrack the start pointer to recover unused space */
 
   if (! BMTST(vbm, start))
-    {
-      while (start > 0 && ! BMTST(vbm, start - 1))
-	--start;
-    }
+    start = bm_rfindset(vbm, start);
 
   /* find largest unused block which satisfies request */
 
@@ -659,8 +993,7 @@ int v_allocblocks(hfsvol *vol, ExtDescriptor *blocks)
 
       /* skip blocks in use */
 
-      while (pt < end && BMTST(vbm, pt))
-	++pt;
+      pt = bm_findclr(vbm, pt, end);
 
       if (wrap && pt >= start)
 	break;
@@ -668,13 +1001,12 @@ int v_allocblocks(hfsvol *vol, ExtDescriptor *blocks)
       /* count blocks not in use */
 
       mark = pt;
-      while (pt < end && pt - mark < request && ! BMTST(vbm, pt))
-	++pt;
+      pt   = bm_findset(vbm, pt, end - pt > request ? pt + request : end);
 
       if (pt - mark > found)
 	{
-	  found   = pt - mark;
-	  foundat = mark;
+	  found    = pt - mark;
+	  *foundat = mark;
 	}
 
       if (wrap && pt >= start)
@@ -687,22 +1019,110 @@ int v_allocblocks(hfsvol *vol, ExtDescriptor *blocks)
 	break;
     }
 
-  if (found == 0 || found > vol->mdb.drFreeBks)
-    ERROR(EIO, "bad volume bitmap or free block count");
+  return found;
+}
+
+/*
+ * NAME:	nearblocks()
+ * DESCRIPTION:	search the bitmap a short way for request free blocks
+ */
+static
+unsigned int nearblocks(hfsvol *vol, unsigned int start,
+			unsigned int request, unsigned int *foundat)
+{
+  unsigned int end = vol->mdb.drNmAlBlks, limit, mark;
+  register unsigned int pt;
+  const byte *vbm = (const byte *) vol->vbm;
+
+  /* begin with the run containing start, as the free map would */
+
+  if (start >= end)
+    start = 0;
+  else if (! BMTST(vbm, start))
+    start = bm_rfindset(vbm, start);
+
+  limit = end - start > HFS_ALLOCWIN ? start + HFS_ALLOCWIN : end;
+
+  for (pt = bm_findclr(vbm, start, limit); pt < limit;
+       pt = bm_findclr(vbm, pt, limit))
+    {
+      mark = pt;
+      pt   = bm_findset(vbm, pt, end - pt > request ? pt + request : end);
+
+      if (pt - mark == request)
+	{
+	  *foundat = mark;
+	  return request;
+	}
+    }
+
+  return 0;
+}
+
+/*
+ * NAME:	vol->allocblocks()
+ * DESCRIPTION:	allocate a contiguous range of blocks
+ */
+int v_allocblocks(hfsvol *vol, ExtDescriptor *blocks)
+{
+  unsigned int request, found, foundat, start;
+  register unsigned int pt;
+  byte *vbm;
+
+  if (vol->mdb.drFreeBks == 0)
+    ERROR(ENOSPC, "volume full");
+
+  if (v_readvbm(vol) == -1)
+    goto fail;
+
+  request = blocks->xdrNumABlks;
+  start   = vol->mdb.drAllocPtr;
+  vbm     = (byte *) vol->vbm;
+
+  ASSERT(request > 0);
+
+  /* consult the free map, or search the bitmap if it can't be built */
+
+  if (vol->fmap == 0)
+    fm_build(vol);
+
+  /* a first fit usually lies close by; look there before the map */
+
+  found = 0;
+  if (! (vol->flags & HFS_OPT_BESTFIT))
+    found = nearblocks(vol, start, request, &foundat);
+
+  if (found)
+    fm_claim(vol, foundat, found);
+  else if (vol->fmap && fm_sync(vol) != -1)
+    found = fm_take(vol, start, request,
+		    vol->flags & HFS_OPT_BESTFIT, &foundat);
+  else
+    found = scanblocks(vol, start, request, &foundat);
+
+  if (found == 0 || found > vol->mdb.drFreeBks ||
+      bm_findset(vbm, foundat, foundat + found) != foundat + found)
+    {
+      fm_free(vol);
+      ERROR(EIO, "bad volume bitmap or free block count");
+    }
 
   blocks->xdrStABN    = foundat;
   blocks->xdrNumABlks = found;
 
   if (v_dirty(vol) == -1)
-    goto fail;
+    {
+      fm_free(vol);
+      goto fail;
+    }
 
-  vol->mdb.drAllocPtr = pt;
+  vol->mdb.drAllocPtr = foundat + found;
   vol->mdb.drFreeBks -= found;
 
-  for (pt = foundat; pt < foundat + found; ++pt)
-    BMSET(vbm, pt);
+  bm_setrange(vbm, foundat, foundat + found);
+  v_dirtyvbm(vol, foundat, foundat + found);
 
-  vol->flags |= HFS_VOL_UPDATE_MDB | HFS_VOL_UPDATE_VBM;
+  vol->flags |= HFS_VOL_UPDATE_MDB;
 
   if (vol->flags & HFS_OPT_ZERO)
     {
@@ -730,22 +1150,25 @@ fail:
  */
 int v_freeblocks(hfsvol *vol, const ExtDescriptor *blocks)
 {
-  unsigned int start, len, pt;
-  block *vbm;
+  unsigned int start, len;
+  byte *vbm;
 
   start = blocks->xdrStABN;
   len   = blocks->xdrNumABlks;
-  vbm   = vol->vbm;
 
-  if (v_dirty(vol) == -1)
+  if (v_loadvbm(vol, start, start + len) == -1 ||
+      v_dirty(vol) == -1 ||
+      fm_give(vol, start, len) == -1)
     goto fail;
 
+  vbm = (byte *) vol->vbm;
+
   vol->mdb.drFreeBks += len;
 
-  for (pt = start; pt < start + len; ++pt)
-    BMCLR(vbm, pt);
+  bm_clrrange(vbm, start, start + len);
+  v_dirtyvbm(vol, start, start + len);
 
-  vol->flags |= HFS_VOL_UPDATE_MDB | HFS_VOL_UPDATE_VBM;
+  vol->flags |= HFS_VOL_UPDATE_MDB;
 
   return 0;
 
@@ -870,7 +1293,9 @@ int v_resolve(hfsvol **vol, const char *path,
       if (parid)
 	*parid = dirid;
 
-      found = v_catsearch(*vol, dirid, name, data, fname, np);
+      /* only the last component's node is of interest */
+
+      found = v_catsearch(*vol, dirid, name, data, fname, *path ? 0 : np);
       if (found == -1)
 	goto fail;
 
@@ -1027,29 +1452,85 @@ fail:
  * DESCRIPTION:	set bits from an extent record in the volume bitmap
  */
 static
-void markexts(block *vbm, const ExtDataRec *exts)
+void markexts(hfsvol *vol, const ExtDataRec *exts)
 {
+  byte *vbm = (byte *) vol->vbm;
+  unsigned int start, end;
   int i;
-  unsigned int pt, len;
 
   for (i = 0; i < 3; ++i)
     {
-      for ( pt = (*exts)[i].xdrStABN,
-	   len = (*exts)[i].xdrNumABlks; len--; ++pt)
-	BMSET(vbm, pt);
+      start = (*exts)[i].xdrStABN;
+      end   = start + (*exts)[i].xdrNumABlks;
+
+      if (bm_findclr(vbm, start, end) < end)
+	{
+	  bm_setrange(vbm, start, end);
+	  v_dirtyvbm(vol, start, end);
+	}
     }
 }
 
+typedef struct {
+  hfsvol *vol;			/* volume whose bitmap is being rebuilt */
+  unsigned long lastcnid;	/* largest CNID seen so far */
+} scavstate;
+
+/*
+ * NAME:	scavext()
+ * DESCRIPTION:	mark the blocks of an extents overflow record in use
+ */
+static
+int scavext(const byte *ptr, void *arg)
+{
+  scavstate *scav = arg;
+  ExtDataRec data;
+
+  r_unpackextdata(HFS_RECDATA(ptr), &data);
+  markexts(scav->vol, &data);
+
+  return 0;
+}
+
+/*
+ * NAME:	scavcat()
+ * DESCRIPTION:	mark the blocks of a catalog file record in use; track CNIDs
+ */
+static
+int scavcat(const byte *ptr, void *arg)
+{
+  scavstate *scav = arg;
+  CatDataRec data;
+
+  r_unpackcatdata(HFS_RECDATA(ptr), &data);
+
+  switch (data.cdrType)
+    {
+    case cdrFilRec:
+      markexts(scav->vol, &data.u.fil.filExtRec);
+      markexts(scav->vol, &data.u.fil.filRExtRec);
+
+      if (data.u.fil.filFlNum > scav->lastcnid)
+	scav->lastcnid = data.u.fil.filFlNum;
+      break;
+
+    case cdrDirRec:
+      if (data.u.dir.dirDirID > scav->lastcnid)
+	scav->lastcnid = data.u.dir.dirDirID;
+      break;
+    }
+
+  return 0;
+}
+
 /*
  * NAME:	vol->scavenge()
  * DESCRIPTION:	safeguard blocks in the volume bitmap
  */
 int v_scavenge(hfsvol *vol)
 {
-  block *vbm = vol->vbm;
-  node n;
-  unsigned int pt, blks;
-  unsigned long lastcnid = 15;
+  scavstate scav;
+  unsigned int blks;
 
 # ifdef DEBUG
   fprintf(stderr, "VOL: \"%s\" not cleanly unmounted\n",
@@ -1069,102 +1550,31 @@ int v_scavenge(hfsvol *vol)
   if (v_dirty(vol) == -1)
     goto fail;
 
-  /* begin by marking extents in MDB */
-
-  markexts(vbm, &vol->mdb.drXTExtRec);
-  markexts(vbm, &vol->mdb.drCTExtRec);
-
-  vol->flags |= HFS_VOL_UPDATE_VBM;
+  /* load the whole bitmap; marking it will invalidate any free map */
 
-  /* scavenge the extents overflow file */
-
-  if (vol->ext.hdr.bthFNode > 0)
-    {
-      if (bt_getnode(&n, &vol->ext, vol->ext.hdr.bthFNode) == -1)
-	goto fail;
-
-      n.rnum = 0;
-
-      while (1)
-	{
-	  ExtDataRec data;
-	  const byte *ptr;
-
-	  while (n.rnum >= n.nd.ndNRecs && n.nd.ndFLink > 0)
-	    {
-	      if (bt_getnode(&n, &vol->ext, n.nd.ndFLink) == -1)
-		goto fail;
-
-	      n.rnum = 0;
-	    }
-
-	  if (n.rnum >= n.nd.ndNRecs && n.nd.ndFLink == 0)
-	    break;
-
-	  ptr = HFS_NODEREC(n, n.rnum);
-	  r_unpackextdata(HFS_RECDATA(ptr), &data);
-
-	  markexts(vbm, &data);
-
-	  ++n.rnum;
-	}
-    }
-
-  /* scavenge the catalog file */
-
-  if (vol->cat.hdr.bthFNode > 0)
-    {
-      if (bt_getnode(&n, &vol->cat, vol->cat.hdr.bthFNode) == -1)
-	goto fail;
-
-      n.rnum = 0;
-
-      while (1)
-	{
-	  CatDataRec data;
-	  const byte *ptr;
-
-	  while (n.rnum >= n.nd.ndNRecs && n.nd.ndFLink > 0)
-	    {
-	      if (bt_getnode(&n, &vol->cat, n.nd.ndFLink) == -1)
-		goto fail;
-
-	      n.rnum = 0;
-	    }
+  if (v_readvbm(vol) == -1)
+    goto fail;
 
-	  if (n.rnum >= n.nd.ndNRecs && n.nd.ndFLink == 0)
-	    break;
+  fm_free(vol);
 
-	  ptr = HFS_NODEREC(n, n.rnum);
-	  r_unpackcatdata(HFS_RECDATA(ptr), &data);
+  /* begin by marking extents in MDB */
 
-	  switch (data.cdrType)
-	    {
-	    case cdrFilRec:
-	      markexts(vbm, &data.u.fil.filExtRec);
-	      markexts(vbm, &data.u.fil.filRExtRec);
+  markexts(vol, &vol->mdb.drXTExtRec);
+  markexts(vol, &vol->mdb.drCTExtRec);
 
-	      if (data.u.fil.filFlNum > lastcnid)
-		lastcnid = data.u.fil.filFlNum;
-	      break;
+  /* scavenge the extents overflow and catalog files */
 
-	    case cdrDirRec:
-	      if (data.u.dir.dirDirID > lastcnid)
-		lastcnid = data.u.dir.dirDirID;
-	      break;
-	    }
+  scav.vol      = vol;
+  scav.lastcnid = 15;
 
-	  ++n.rnum;
-	}
-    }
+  if (bt_walk(&vol->ext, scavext, &scav) == -1 ||
+      bt_walk(&vol->cat, scavcat, &scav) == -1)
+    goto fail;
 
   /* count free blocks */
 
-  for (blks = 0, pt = vol->mdb.drNmAlBlks; pt--; )
-    {
-      if (! BMTST(vbm, pt))
-	++blks;
-    }
+  blks = vol->mdb.drNmAlBlks -
+    bm_count((const byte *) vol->vbm, 0, vol->mdb.drNmAlBlks);
 
   if (vol->mdb.drFreeBks != blks)
     {
@@ -1179,14 +1589,14 @@ int v_scavenge(hfsvol *vol)
 
   /* ensure next CNID is sane */
 
-  if ((unsigned long) vol->mdb.drNxtCNID <= lastcnid)
+  if ((unsigned long) vol->mdb.drNxtCNID <= scav.lastcnid)
     {
 # ifdef DEBUG
       fprintf(stderr, "VOL: updating next CNID from %lu to %lu\n",
-	      vol->mdb.drNxtCNID, lastcnid + 1);
+	      vol->mdb.drNxtCNID, scav.lastcnid + 1);
 # endif
 
-      vol->mdb.drNxtCNID = lastcnid + 1;
+      vol->mdb.drNxtCNID = scav.lastcnid + 1;
       vol->flags |= HFS_VOL_UPDATE_MDB;
     }
 
@@ -22,6 +22,7 @@
 void v_init(hfsvol *, int);
 
 int v_open(hfsvol *, const char *, int);
+int v_openio(hfsvol *, void *, const struct hfsioprocs *, int);
 int v_flush(hfsvol *);
 int v_close(hfsvol *);
 
@@ -31,12 +32,16 @@ int v_geometry(hfsvol *, int);
 int v_readmdb(hfsvol *);
 int v_writemdb(hfsvol *);
 
+int v_loadvbm(hfsvol *, unsigned int, unsigned int);
 int v_readvbm(hfsvol *);
 int v_writevbm(hfsvol *);
+void v_dirtyvbm(hfsvol *, unsigned int, unsigned int);
 
 int v_mount(hfsvol *);
 int v_dirty(hfsvol *);
 
+void v_dpurge(hfsvol *, unsigned long, const char *);
+
 int v_catsearch(hfsvol *, unsigned long, const char *,
 		CatDataRec *, char *, node *);
 int v_extsearch(hfsfile *, unsigned int, ExtDataRec *, node *);
@@ -216,8 +216,19 @@ int hcwd_finish(void)
       free(mounts);
     }
 
+  /* leave the table empty so the state may be read again */
+
+  mounts = 0;
+  mtabsz = nmounts = 0;
+  curvol = -1;
+
   if (statef && fclose(statef) == EOF)
-    return -1;
+    {
+      statef = 0;
+      return -1;
+    }
+
+  statef = 0;
 
   return 0;
 }
@@ -36,6 +36,7 @@
 # include "hfs.h"
 # include "hcwd.h"
 # include "hfsutil.h"
+# include "hfsutild.h"
 # include "suid.h"
 # include "glob.h"
 # include "version.h"
@@ -56,6 +57,476 @@
 
 const char *argv0, *bargv0;
 
+static
+struct command {
+  const char *name;
+  int (*func)(int, char *[]);
+} commands[] = {
+  { "hattrib", hattrib_main },
+  { "hcd",     hcd_main     },
+  { "hcopy",   hcopy_main   },
+  { "hdel",    hdel_main    },
+  { "hdir",    hls_main     },
+  { "hformat", hformat_main },
+  { "hls",     hls_main     },
+  { "hmkdir",  hmkdir_main  },
+  { "hmount",  hmount_main  },
+  { "hpwd",    hpwd_main    },
+  { "hrename", hrename_main },
+  { "hrmdir",  hrmdir_main  },
+  { "humount", humount_main },
+  { "hvol",    hvol_main    },
+  { "mkfs.hfs", hformat_main },
+  { "mkfs.hfs+", hformat_main },
+  { "mkfs.hfsplus", hformat_main },
+  { 0,         0            }
+};
+
+/* during a batch, volumes stay mounted between commands */
+
+# define KEEPMAX	4
+
+static
+int batching;				/* true while running a batch */
+
+static
+struct kept {
+  hfsvol *vol;				/* mounted volume (or 0) */
+  char *path;				/* UNIX path of volume */
+  int partno;				/* partition number of volume */
+  int lent;				/* in use by a command */
+  unsigned long used;			/* time of last use */
+} kept[KEEPMAX];
+
+static
+unsigned long keepclock;		/* advances with each use */
+
+/*
+ * NAME:	dropvol()
+ * DESCRIPTION:	unmount a volume kept mounted by a batch
+ */
+static
+int dropvol(struct kept *kp)
+{
+  int result = 0;
+
+  if (kp->vol == 0)
+    return 0;
+
+  if (hfs_umount(kp->vol) == -1)
+    {
+      hfsutil_perror("Error closing HFS volume");
+      result = -1;
+    }
+
+  free(kp->path);
+
+  kp->vol  = 0;
+  kp->path = 0;
+  kp->lent = 0;
+
+  return result;
+}
+
+/*
+ * NAME:	findkept()
+ * DESCRIPTION:	return the kept entry for a mounted volume, or 0
+ */
+static
+struct kept *findkept(hfsvol *vol)
+{
+  struct kept *kp;
+
+  for (kp = kept; kp < kept + KEEPMAX; ++kp)
+    {
+      if (kp->vol && kp->vol == vol)
+	return kp;
+    }
+
+  return 0;
+}
+
+/*
+ * NAME:	keepvol()
+ * DESCRIPTION:	return a batch's mounted volume, mounting it if necessary
+ */
+static
+hfsvol *keepvol(mountent *ment)
+{
+  struct kept *kp, *slot = kept;
+  char *path;
+
+  for (kp = kept; kp < kept + KEEPMAX; ++kp)
+    {
+      if (kp->vol &&
+	  kp->partno == ment->partno && strcmp(kp->path, ment->path) == 0)
+	break;
+
+      /* otherwise prefer an empty entry, then the least recently used */
+
+      if (slot->vol && (kp->vol == 0 || kp->used < slot->used))
+	slot = kp;
+    }
+
+  if (kp == kept + KEEPMAX)
+    {
+      kp = slot;
+      dropvol(kp);
+
+      path = strdup(ment->path);
+      if (path == 0)
+	{
+	  ERROR(ENOMEM, 0);
+	  return 0;
+	}
+
+      /* commands share the volume, so mount it for writing if possible */
+
+      suid_enable();
+      kp->vol = hfs_mount(ment->path, ment->partno, HFS_MODE_ANY);
+      suid_disable();
+
+      if (kp->vol == 0)
+	{
+	  free(path);
+	  return 0;
+	}
+
+      kp->path   = path;
+      kp->partno = ment->partno;
+    }
+
+  /* as though freshly mounted, the volume becomes libhfs's current one */
+
+  hfs_setvol(kp->vol);
+
+  kp->lent = 1;
+  kp->used = ++keepclock;
+
+  return kp->vol;
+}
+
+/*
+ * NAME:	dropall()
+ * DESCRIPTION:	unmount every volume kept mounted by a batch
+ */
+static
+int dropall(void)
+{
+  struct kept *kp;
+  int result = 0;
+
+  for (kp = kept; kp < kept + KEEPMAX; ++kp)
+    {
+      if (dropvol(kp) == -1)
+	result = -1;
+    }
+
+  return result;
+}
+
+/*
+ * NAME:	readline()
+ * DESCRIPTION:	read a line of any length without its newline (must be free()'d)
+ */
+static
+char *readline(FILE *stream)
+{
+  char *line = 0, *new;
+  size_t size = 0, len = 0;
+
+  while (1)
+    {
+      if (size - len < 2)
+	{
+	  size = size ? size << 1 : 256;
+
+	  new = realloc(line, size);
+	  if (new == 0)
+	    {
+	      free(line);
+	      return 0;
+	    }
+
+	  line = new;
+	}
+
+      if (fgets(line + len, size - len, stream) == 0)
+	break;
+
+      len += strlen(line + len);
+
+      if (len > 0 && line[len - 1] == '\n')
+	{
+	  line[--len] = 0;
+	  return line;
+	}
+    }
+
+  if (len == 0)
+    {
+      free(line);
+      return 0;
+    }
+
+  return line;
+}
+
+/*
+ * NAME:	splitline()
+ * DESCRIPTION:	break a line into words in place; return word count or -1
+ */
+static
+int splitline(char *line, char ***argvp)
+{
+  char **argv = 0, **new, *in, *out;
+  int argc = 0, size = 0;
+
+  in = line;
+
+  while (1)
+    {
+      while (isspace((unsigned char) *in))
+	++in;
+
+      if (*in == 0 || *in == '#')
+	break;
+
+      if (argc + 2 > size)
+	{
+	  size = size ? size << 1 : 16;
+
+	  new = realloc(argv, size * sizeof(*argv));
+	  if (new == 0)
+	    goto fail;
+
+	  argv = new;
+	}
+
+      /* words may be quoted as in the shell: '...', "...", or \c */
+
+      argv[argc++] = out = in;
+
+      while (*in && ! isspace((unsigned char) *in))
+	{
+	  switch (*in)
+	    {
+	    case '\'':
+	      for (++in; *in && *in != '\''; )
+		*out++ = *in++;
+
+	      if (*in++ == 0)
+		goto fail;
+	      break;
+
+	    case '"':
+	      for (++in; *in && *in != '"'; )
+		{
+		  if (*in == '\\' && (in[1] == '"' || in[1] == '\\'))
+		    ++in;
+
+		  *out++ = *in++;
+		}
+
+	      if (*in++ == 0)
+		goto fail;
+	      break;
+
+	    case '\\':
+	      if (in[1])
+		++in;
+
+	      /* fall through */
+
+	    default:
+	      *out++ = *in++;
+	    }
+	}
+
+      if (*in)
+	++in;
+
+      *out = 0;
+    }
+
+  if (argv)
+    argv[argc] = 0;
+
+  *argvp = argv;
+
+  return argc;
+
+fail:
+  free(argv);
+
+  *argvp = 0;
+
+  return -1;
+}
+
+/*
+ * NAME:	hfsutil->keep()
+ * DESCRIPTION:	begin or end keeping volumes mounted between commands
+ */
+int hfsutil_keep(int flag)
+{
+  batching = flag;
+
+  return flag ? 0 : dropall();
+}
+
+/*
+ * NAME:	hfsutil->sync()
+ * DESCRIPTION:	write out changes to all kept volumes, leaving them mounted
+ */
+int hfsutil_sync(void)
+{
+  struct kept *kp;
+  int result = 0;
+
+  for (kp = kept; kp < kept + KEEPMAX; ++kp)
+    {
+      if (kp->vol && hfs_flush(kp->vol) == -1)
+	{
+	  hfsutil_perror("Error flushing HFS volume");
+	  result = -1;
+	}
+    }
+
+  return result;
+}
+
+/*
+ * NAME:	hfsutil->run()
+ * DESCRIPTION:	run a command by name; return -1 if there is no such command
+ */
+int hfsutil_run(int argc, char *argv[], int *result)
+{
+  struct command *cmd;
+  int dropped = 0;
+
+  for (cmd = commands; cmd->name; ++cmd)
+    {
+      if (strcmp(argv[0], cmd->name) == 0)
+	break;
+    }
+
+  if (cmd->name == 0)
+    return -1;
+
+  /* formatting rewrites the medium beneath any kept volume */
+
+  if (cmd->func == hformat_main)
+    dropped = dropall();
+
+  /* start option parsing afresh for each command */
+
+# ifdef __GLIBC__
+  optind = 0;
+# else
+  optind = 1;
+# endif
+
+  bargv0 = cmd->name;
+
+  *result = cmd->func(argc, argv);
+  if (dropped == -1)
+    *result = 1;
+
+  return 0;
+}
+
+/*
+ * NAME:	batch()
+ * DESCRIPTION:	run commands from a file against volumes kept mounted
+ */
+static
+int batch(int argc, char *argv[])
+{
+  FILE *in = stdin;
+  char *line, **args;
+  int nargs, lineno = 0, status, result = 0;
+
+  if (argc > 2)
+    {
+      fprintf(stderr, "Usage: %s batch [file]\n", argv0);
+      return 1;
+    }
+
+  if (argc == 2 && strcmp(argv[1], "-") != 0)
+    {
+      in = fopen(argv[1], "r");
+      if (in == 0)
+	{
+	  fprintf(stderr, "%s: can't open \"%s\": %s\n",
+		  argv0, argv[1], strerror(errno));
+	  return 1;
+	}
+    }
+
+  if (hcwd_init() == -1)
+    {
+      perror("Failed to initialize HFS working directories");
+      return 1;
+    }
+
+  hfsutil_keep(1);
+
+  while ((line = readline(in)) != 0)
+    {
+      ++lineno;
+
+      nargs = splitline(line, &args);
+      if (nargs == -1)
+	{
+	  fprintf(stderr, "%s: line %d: unterminated quote or out of memory\n",
+		  argv0, lineno);
+	  result = 1;
+	}
+      else if (nargs == 0)
+	;
+      else if (strcmp(args[0], "sync") == 0)
+	{
+	  /* write out everything changed so far, but stay mounted */
+
+	  if (hfsutil_sync() == -1)
+	    result = 1;
+	}
+      else if (hfsutil_run(nargs, args, &status) == -1)
+	{
+	  fprintf(stderr, "%s: line %d: Unknown command `%s'\n",
+		  argv0, lineno, args[0]);
+	  result = 1;
+	}
+      else if (status != 0)
+	result = 1;
+
+      free(args);
+      free(line);
+    }
+
+  if (ferror(in))
+    {
+      fprintf(stderr, "%s: error reading commands: %s\n",
+	      argv0, strerror(errno));
+      result = 1;
+    }
+
+  if (hfsutil_keep(0) == -1)
+    result = 1;
+
+  if (hcwd_finish() == -1)
+    {
+      perror("Failed to save working directory state");
+      result = 1;
+    }
+
+  if (in != stdin)
+    fclose(in);
+
+  return result;
+}
+
 /*
  * NAME:	main()
  * DESCRIPTION:	program entry dispatch
@@ -65,29 +536,7 @@ int main(int argc, char *argv[])
   int i, len;
   const char *dot;
 
-  struct {
-    const char *name;
-    int (*func)(int, char *[]);
-  } list[] = {
-    { "hattrib", hattrib_main },
-    { "hcd",     hcd_main     },
-    { "hcopy",   hcopy_main   },
-    { "hdel",    hdel_main    },
-    { "hdir",    hls_main     },
-    { "hformat", hformat_main },
-    { "hls",     hls_main     },
-    { "hmkdir",  hmkdir_main  },
-    { "hmount",  hmount_main  },
-    { "hpwd",    hpwd_main    },
-    { "hrename", hrename_main },
-    { "hrmdir",  hrmdir_main  },
-    { "humount", humount_main },
-    { "hvol",    hvol_main    },
-    { "mkfs.hfs", hformat_main },
-    { "mkfs.hfs+", hformat_main },
-    { "mkfs.hfsplus", hformat_main },
-    { 0,         0            }
-  };
+  struct command *list = commands;
 
   suid_init();
 
@@ -117,6 +566,9 @@ int main(int argc, char *argv[])
   dot = strchr(bargv0, '.');
   len = dot ? dot - bargv0 : strlen(bargv0);
 
+  if (strcmp(bargv0, "hfsutild") == 0)
+    return hfsutild_main(argc, argv);
+
   /* Check if called as 'hfsutil' with a subcommand */
   if (strcmp(bargv0, "hfsutil") == 0 || strncmp(bargv0, "hfsutil", len) == 0)
     {
@@ -133,6 +585,8 @@ int main(int argc, char *argv[])
                 fprintf(stderr, "\n");
             }
           fprintf(stderr, "\n\nFor help on a specific command: %s <command> -h\n", argv0);
+          fprintf(stderr, "To run many commands on one mounted volume: %s batch [file]\n", argv0);
+          fprintf(stderr, "To keep volumes mounted between commands: %s daemon\n", argv0);
           fprintf(stderr, "For version info: %s --version\n", argv0);
           fprintf(stderr, "For license info: %s --license\n", argv0);
           return 1;
@@ -143,6 +597,11 @@ int main(int argc, char *argv[])
       argv[1] = argv[0];  /* Shift argv[0] to argv[1] for compatibility */
       argv++;
       argc--;
+
+      if (strcmp(bargv0, "batch") == 0)
+	return batch(argc, argv);
+      else if (strcmp(bargv0, "daemon") == 0)
+	return hfsutild_main(argc, argv);
     }
 
   /* Look up the command */
@@ -154,6 +613,11 @@ int main(int argc, char *argv[])
 
 	  bargv0 = list[i].name;
 
+	  /* a running hfsutild has the volume mounted already */
+
+	  if (hfsutild_forward(argc, argv, bargv0, &result) == 0)
+	    return result;
+
 	  if (hcwd_init() == -1)
 	    {
 	      perror("Failed to initialize HFS working directories");
@@ -213,6 +677,7 @@ hfsvol *hfsutil_remount(mountent *ment, int flags)
 {
   hfsvol *vol;
   hfsvolent vent;
+  struct kept *kp;
 
   if (ment == 0)
     {
@@ -221,9 +686,14 @@ hfsvol *hfsutil_remount(mountent *ment, int flags)
       return 0;
     }
 
-  suid_enable();
-  vol = hfs_mount(ment->path, ment->partno, flags);
-  suid_disable();
+  if (batching)
+    vol = keepvol(ment);
+  else
+    {
+      suid_enable();
+      vol = hfs_mount(ment->path, ment->partno, flags);
+      suid_disable();
+    }
 
   if (vol == 0)
     {
@@ -240,7 +710,12 @@ hfsvol *hfsutil_remount(mountent *ment, int flags)
       fprintf(stderr, "%s: Replace media on %s or use `hmount'\n",
 	      argv0, ment->path);
 
-      hfs_umount(vol);
+      kp = findkept(vol);
+      if (kp)
+	dropvol(kp);
+      else
+	hfs_umount(vol);
+
       return 0;
     }
 
@@ -259,6 +734,17 @@ hfsvol *hfsutil_remount(mountent *ment, int flags)
  */
 void hfsutil_unmount(hfsvol *vol, int *result)
 {
+  struct kept *kp;
+
+  /* a batch flushes its volumes only on `sync' or at the end */
+
+  kp = findkept(vol);
+  if (kp && kp->lent)
+    {
+      kp->lent = 0;
+      return;
+    }
+
   if (hfs_umount(vol) == -1 && *result == 0)
     {
       hfsutil_perror("Error closing HFS volume");
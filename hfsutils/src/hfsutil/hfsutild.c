@@ -0,0 +1,746 @@
+/*
+ * hfsutils - tools for reading and writing Macintosh HFS volumes
+ * Copyright (C) 1996-1998 Robert Leslie
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * $Id$
+ */
+
+# ifdef HAVE_CONFIG_H
+#  include "../../include/config.h"
+# endif
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+# include <signal.h>
+# include <fcntl.h>
+# include <poll.h>
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <sys/time.h>
+# include <sys/socket.h>
+# include <sys/un.h>
+
+# include <unistd.h>
+
+# include "hfs.h"
+# include "hcwd.h"
+# include "hfsutil.h"
+# include "hfsutild.h"
+
+# define SOCKFNAME	".hfsutild"
+# define SOCKENV	"HFSUTILD_SOCKET"
+
+# define REQMAGIC	0x48464431L	/* 'HFD1' */
+# define REQMAXLEN	(1024L * 1024)
+# define REQTIMEOUT	5		/* seconds a client may take to send */
+
+# define REQ_RUN	0		/* run a command */
+# define REQ_QUIT	1		/* unmount everything and exit */
+
+/*
+ * A request is this header, carrying the client's standard descriptors,
+ * followed by `len' bytes of NUL-terminated strings: the client's working
+ * directory, its HOME, its argv[0], the command name, and the arguments.
+ * The reply is the command's exit status.
+ */
+
+struct request {
+  unsigned long magic;
+  int type;
+  int nstrs;
+  unsigned long len;
+};
+
+static
+volatile sig_atomic_t quit;		/* set by a signal to stop serving */
+
+/*
+ * NAME:	sockpath()
+ * DESCRIPTION:	fill in the daemon's socket address; return -1 if disabled
+ */
+static
+int sockpath(struct sockaddr_un *addr)
+{
+  const char *path, *home = "";
+  size_t len;
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+
+  path = getenv(SOCKENV);
+  if (path)
+    {
+      if (*path == 0)
+	return -1;
+
+      len = strlen(path);
+    }
+  else
+    {
+      home = getenv("HOME");
+      if (home == 0)
+	home = "";
+
+      path = "/" SOCKFNAME;
+      len  = strlen(home) + strlen(path);
+    }
+
+  if (len >= sizeof(addr->sun_path))
+    {
+      ERROR(ENAMETOOLONG, "socket path too long");
+      return -1;
+    }
+
+  strcpy(addr->sun_path, home);
+  strcat(addr->sun_path, path);
+
+  return 0;
+}
+
+/*
+ * NAME:	dial()
+ * DESCRIPTION:	connect to a running daemon; return a socket or -1
+ */
+static
+int dial(void)
+{
+  struct sockaddr_un addr;
+  int sock;
+
+  if (sockpath(&addr) == -1)
+    return -1;
+
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock == -1)
+    return -1;
+
+  if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+    {
+      close(sock);
+      return -1;
+    }
+
+  return sock;
+}
+
+/*
+ * NAME:	readall()
+ * DESCRIPTION:	read exactly len bytes; return 0, or -1 on error or EOF
+ */
+static
+int readall(int fd, void *buf, size_t len)
+{
+  char *ptr = buf;
+  ssize_t got;
+
+  while (len)
+    {
+      got = read(fd, ptr, len);
+      if (got == -1 && errno == EINTR)
+	continue;
+
+      if (got <= 0)
+	return -1;
+
+      ptr += got;
+      len -= got;
+    }
+
+  return 0;
+}
+
+/*
+ * NAME:	writeall()
+ * DESCRIPTION:	write exactly len bytes; return 0 or -1
+ */
+static
+int writeall(int fd, const void *buf, size_t len)
+{
+  const char *ptr = buf;
+  ssize_t put;
+
+  while (len)
+    {
+      put = write(fd, ptr, len);
+      if (put == -1 && errno == EINTR)
+	continue;
+
+      if (put == -1)
+	return -1;
+
+      ptr += put;
+      len -= put;
+    }
+
+  return 0;
+}
+
+/*
+ * NAME:	sendreq()
+ * DESCRIPTION:	send a request header, passing the given descriptors
+ */
+static
+int sendreq(int sock, struct request *req, int *fds, int nfds)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(3 * sizeof(int))];
+  } control;
+
+  memset(&msg, 0, sizeof(msg));
+
+  iov.iov_base = req;
+  iov.iov_len  = sizeof(*req);
+
+  msg.msg_iov    = &iov;
+  msg.msg_iovlen = 1;
+
+  if (nfds)
+    {
+      msg.msg_control    = control.buf;
+      msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+
+      cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type  = SCM_RIGHTS;
+      cmsg->cmsg_len   = CMSG_LEN(nfds * sizeof(int));
+
+      memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+    }
+
+  while (sendmsg(sock, &msg, 0) == -1)
+    {
+      if (errno != EINTR)
+	return -1;
+    }
+
+  return 0;
+}
+
+/*
+ * NAME:	recvreq()
+ * DESCRIPTION:	receive a request header and up to three descriptors
+ */
+static
+int recvreq(int sock, struct request *req, int *fds, int *nfds)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(3 * sizeof(int))];
+  } control;
+  ssize_t got;
+
+  memset(&msg, 0, sizeof(msg));
+
+  iov.iov_base = req;
+  iov.iov_len  = sizeof(*req);
+
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  *nfds = 0;
+
+  do
+    got = recvmsg(sock, &msg, 0);
+  while (got == -1 && errno == EINTR);
+
+  if (got <= 0)
+    return -1;
+
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+	{
+	  *nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	  memcpy(fds, CMSG_DATA(cmsg), *nfds * sizeof(int));
+	}
+    }
+
+  /* the rest of a short header follows without descriptors */
+
+  if ((size_t) got < sizeof(*req) &&
+      readall(sock, (char *) req + got, sizeof(*req) - got) == -1)
+    return -1;
+
+  if (msg.msg_flags & MSG_CTRUNC)
+    return -1;
+
+  return 0;
+}
+
+/*
+ * NAME:	hfsutild->forward()
+ * DESCRIPTION:	have a running daemon perform a command; return -1 if none
+ */
+int hfsutild_forward(int argc, char *argv[], const char *name, int *result)
+{
+  struct request req;
+  int sock, i, fds[3] = { 0, 1, 2 };
+  char *cwd, *body = 0, *ptr;
+  const char *home, *strs[4];
+  size_t len;
+
+  sock = dial();
+  if (sock == -1)
+    return -1;
+
+  cwd  = hfsutil_abspath(".");
+  home = getenv("HOME");
+
+  if (cwd == 0)
+    goto fail;
+
+  /* drop the trailing "/." but keep a lone "/" */
+
+  len = strlen(cwd);
+  cwd[len > 3 ? len - 2 : 1] = 0;
+
+  strs[0] = cwd;
+  strs[1] = home ? home : "";
+  strs[2] = argv0;
+  strs[3] = name;
+
+  for (len = 0, i = 0; i < 4; ++i)
+    len += strlen(strs[i]) + 1;
+  for (i = 1; i < argc; ++i)
+    len += strlen(argv[i]) + 1;
+
+  body = malloc(len);
+  if (body == 0)
+    goto fail;
+
+  for (ptr = body, i = 0; i < 4; ++i)
+    ptr = strchr(strcpy(ptr, strs[i]), 0) + 1;
+  for (i = 1; i < argc; ++i)
+    ptr = strchr(strcpy(ptr, argv[i]), 0) + 1;
+
+  req.magic = REQMAGIC;
+  req.type  = REQ_RUN;
+  req.nstrs = 4 + argc - 1;
+  req.len   = len;
+
+  if (sendreq(sock, &req, fds, 3) == -1 ||
+      writeall(sock, body, len) == -1 ||
+      readall(sock, result, sizeof(*result)) == -1)
+    {
+      fprintf(stderr, "%s: lost connection to hfsutild\n", argv0);
+      *result = 1;
+    }
+
+  free(body);
+  free(cwd);
+  close(sock);
+
+  return 0;
+
+fail:
+  /* the daemon sees the connection close and ignores it */
+
+  free(cwd);
+  close(sock);
+
+  return -1;
+}
+
+/*
+ * NAME:	serve()
+ * DESCRIPTION:	perform one request from a client; return 1 if asked to quit
+ */
+static
+int serve(int sock, const int *stdfds)
+{
+  struct request req;
+  int fds[3], nfds, nargs, status = 1, result = 0, i;
+  char *body = 0, *ptr, *end, **strs = 0;
+  const char *myargv0 = argv0;
+
+  if (recvreq(sock, &req, fds, &nfds) == -1)
+    goto done;
+
+  if (req.magic != REQMAGIC)
+    goto done;
+
+  /* the reply to a quit request waits until everything is unmounted */
+
+  if (req.type == REQ_QUIT)
+    {
+      quit   = 1;
+      result = 1;
+      goto done;
+    }
+
+  if (req.type != REQ_RUN || nfds != 3 ||
+      req.nstrs < 4 || req.len > REQMAXLEN)
+    goto done;
+
+  body = malloc(req.len);
+  strs = malloc((req.nstrs + 1) * sizeof(*strs));
+  if (body == 0 || strs == 0 ||
+      readall(sock, body, req.len) == -1)
+    goto done;
+
+  /* split the body, which must hold exactly the promised strings */
+
+  end = body + req.len;
+  for (ptr = body, i = 0; i < req.nstrs && ptr < end; ++i)
+    {
+      strs[i] = ptr;
+      ptr = memchr(ptr, 0, end - ptr);
+      if (ptr == 0)
+	goto done;
+
+      ++ptr;
+    }
+
+  if (i < req.nstrs || ptr != end)
+    goto done;
+
+  strs[req.nstrs] = 0;
+
+  /* take on the client's standard streams, directory and state */
+
+  for (i = 0; i < 3; ++i)
+    dup2(fds[i], i);
+
+  argv0 = strs[2];
+
+  if (chdir(strs[0]) == -1)
+    fprintf(stderr, "%s: \"%s\": %s\n", argv0, strs[0], strerror(errno));
+  else if (setenv("PWD", strs[0], 1) == -1 ||
+	   setenv("HOME", strs[1], 1) == -1)
+    perror(argv0);
+  else if (hcwd_init() == -1)
+    perror("Failed to initialize HFS working directories");
+  else
+    {
+      /* the command name replaces the client's argv[0] */
+
+      nargs = req.nstrs - 3;
+
+      if (hfsutil_run(nargs, strs + 3, &status) == -1)
+	{
+	  fprintf(stderr, "%s: Unknown command `%s'\n", argv0, strs[3]);
+	  status = 1;
+	}
+
+      if (hcwd_finish() == -1)
+	{
+	  perror("Failed to save working directory state");
+	  status = 1;
+	}
+
+      /* leave the medium current, so other readers see the changes */
+
+      if (hfsutil_sync() == -1)
+	status = 1;
+    }
+
+  fflush(stdout);
+  fflush(stderr);
+
+  argv0 = myargv0;
+
+  for (i = 0; i < 3; ++i)
+    dup2(stdfds[i], i);
+
+  if (chdir("/") == -1)
+    {
+      /* ignore error intentionally */
+    }
+
+  writeall(sock, &status, sizeof(status));
+
+done:
+  for (i = 0; i < nfds; ++i)
+    close(fds[i]);
+
+  free(strs);
+  free(body);
+
+  return result;
+}
+
+/*
+ * NAME:	stop()
+ * DESCRIPTION:	signal handler to end the daemon
+ */
+static
+void stop(int sig)
+{
+  quit = 1;
+}
+
+/*
+ * NAME:	askquit()
+ * DESCRIPTION:	tell a running daemon to exit
+ */
+static
+int askquit(void)
+{
+  struct request req;
+  int sock, status;
+
+  sock = dial();
+  if (sock == -1)
+    {
+      fprintf(stderr, "%s: hfsutild is not running\n", argv0);
+      return 1;
+    }
+
+  req.magic = REQMAGIC;
+  req.type  = REQ_QUIT;
+  req.nstrs = 0;
+  req.len   = 0;
+
+  if (sendreq(sock, &req, 0, 0) == -1 ||
+      readall(sock, &status, sizeof(status)) == -1)
+    {
+      fprintf(stderr, "%s: lost connection to hfsutild\n", argv0);
+      status = 1;
+    }
+
+  close(sock);
+
+  return status;
+}
+
+/*
+ * NAME:	usage()
+ * DESCRIPTION:	display usage message
+ */
+static
+int usage(void)
+{
+  fprintf(stderr, "Usage: %s [-f] [-t seconds] | -q\n", argv0);
+
+  return 1;
+}
+
+/*
+ * NAME:	hfsutild->main()
+ * DESCRIPTION:	serve commands from a socket, keeping volumes mounted
+ */
+int hfsutild_main(int argc, char *argv[])
+{
+  struct sockaddr_un addr;
+  struct sigaction sa;
+  struct pollfd pfd;
+  struct timeval tv;
+  int opt, sock, conn = -1, fd, i, foreground = 0, idle = 60, busy = 0;
+  int stdfds[3];
+  mode_t mask;
+
+  while ((opt = getopt(argc, argv, "fqt:")) != EOF)
+    {
+      switch (opt)
+	{
+	case '?':
+	  return usage();
+
+	case 'f':
+	  foreground = 1;
+	  break;
+
+	case 'q':
+	  if (argc != 2)
+	    return usage();
+
+	  return askquit();
+
+	case 't':
+	  idle = atoi(optarg);
+	  break;
+	}
+    }
+
+  if (optind != argc)
+    return usage();
+
+  if (sockpath(&addr) == -1)
+    {
+      if (errno == ENAMETOOLONG)
+	hfsutil_perror(getenv(SOCKENV) ? getenv(SOCKENV) : "$HOME");
+      else
+	fprintf(stderr, "%s: %s is empty; daemon disabled\n", argv0, SOCKENV);
+
+      return 1;
+    }
+
+  /* a socket nobody answers was left by a daemon that died */
+
+  sock = dial();
+  if (sock != -1)
+    {
+      close(sock);
+      fprintf(stderr, "%s: hfsutild is already running on %s\n",
+	      argv0, addr.sun_path);
+      return 1;
+    }
+
+  unlink(addr.sun_path);
+
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock == -1)
+    {
+      hfsutil_perror("socket");
+      return 1;
+    }
+
+  /* only the owner may connect */
+
+  mask = umask(077);
+
+  if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+      listen(sock, 8) == -1)
+    {
+      umask(mask);
+      hfsutil_perror(addr.sun_path);
+      close(sock);
+      return 1;
+    }
+
+  umask(mask);
+
+  if (! foreground)
+    {
+      switch (fork())
+	{
+	case -1:
+	  hfsutil_perror("fork");
+	  close(sock);
+	  unlink(addr.sun_path);
+	  return 1;
+
+	case 0:
+	  break;
+
+	default:
+	  /* the socket is already listening, so clients may connect now */
+
+	  return 0;
+	}
+
+      setsid();
+
+      fd = open("/dev/null", O_RDWR);
+      if (fd != -1)
+	{
+	  for (i = 0; i < 3; ++i)
+	    dup2(fd, i);
+
+	  if (fd > 2)
+	    close(fd);
+	}
+    }
+
+  for (i = 0; i < 3; ++i)
+    stdfds[i] = dup(i);
+
+  if (chdir("/") == -1)
+    {
+      /* ignore error intentionally */
+    }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &sa, 0);
+
+  /* no SA_RESTART, so that a signal interrupts poll() */
+
+  sa.sa_handler = stop;
+  sigaction(SIGTERM, &sa, 0);
+  sigaction(SIGINT,  &sa, 0);
+  sigaction(SIGHUP,  &sa, 0);
+
+  /* commands may read stdin; buffering would keep data between clients */
+
+  setvbuf(stdin, 0, _IONBF, 0);
+
+  hfsutil_keep(1);
+
+  pfd.fd     = sock;
+  pfd.events = POLLIN;
+
+  while (! quit)
+    {
+      /* let go of idle volumes, so other programs may open them */
+
+      switch (poll(&pfd, 1, busy && idle > 0 ? idle * 1000 : -1))
+	{
+	case -1:
+	  if (errno == EINTR)
+	    continue;
+
+	  hfsutil_perror("poll");
+	  quit = 1;
+	  continue;
+
+	case 0:
+	  hfsutil_keep(0);
+	  hfsutil_keep(1);
+	  busy = 0;
+	  continue;
+	}
+
+      conn = accept(sock, 0, 0);
+      if (conn == -1)
+	continue;
+
+      /* a client that stalls mid-request must not wedge the daemon */
+
+      tv.tv_sec  = REQTIMEOUT;
+      tv.tv_usec = 0;
+
+      if (setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1)
+	{
+	  close(conn);
+	  conn = -1;
+	  continue;
+	}
+
+      if (serve(conn, stdfds) == 1)
+	break;
+
+      close(conn);
+      conn = -1;
+
+      busy = 1;
+    }
+
+  i = hfsutil_keep(0) == -1;
+
+  close(sock);
+  unlink(addr.sun_path);
+
+  if (conn != -1)
+    {
+      writeall(conn, &i, sizeof(i));
+      close(conn);
+    }
+
+  return i;
+}
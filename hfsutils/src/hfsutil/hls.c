@@ -671,7 +671,7 @@ static
 int process(hfsvol *vol, darray *dirs, darray *files,
 	    int flags, int options, int width)
 {
-  int i, dsz, fsz;
+  int i, dsz, fsz, fields;
   queueent *ents;
   int result = 0;
 
@@ -689,18 +689,32 @@ int process(hfsvol *vol, darray *dirs, darray *files,
   else if (dsz > 1)
     flags |= HLS_NAME;
 
+  /* decode only the catalog fields that will be shown or sorted on */
+
+  fields = HFS_DIRENT_FINDER;
+
+  if ((options & F_MASK) == F_LONG || (options & S_MASK) == S_TIME)
+    fields |= HFS_DIRENT_DATES;
+  if ((options & F_MASK) == F_LONG || (options & S_MASK) == S_SIZE ||
+      (flags & HLS_SIZE))
+    fields |= HFS_DIRENT_SIZES;
+
   ents = darr_array(dirs);
 
   for (i = 0; i < dsz; ++i)
     {
       const char *path;
       hfsdir *dir;
+      hfsdirent batch[64];
       queueent ent;
+      int j, n;
 
       darr_shrink(files, 0);
 
+      /* descend by directory ID; the path is only needed for display */
+
       path = PATH(ents[i]);
-      dir  = hfs_opendir(vol, path);
+      dir  = hfs_opendir_id(vol, ents[i].dirent.cnid);
       if (dir == 0)
 	{
 	  hfsutil_perrorp(path);
@@ -708,8 +722,30 @@ int process(hfsvol *vol, darray *dirs, darray *files,
 	  continue;
 	}
 
-      while (hfs_readdir(dir, &ent.dirent) != -1)
+      j = n = 0;
+
+      while (1)
 	{
+	  if (j == n)
+	    {
+	      n = hfs_readdir_batch(dir, batch,
+				    sizeof(batch) / sizeof(batch[0]), fields);
+	      if (n <= 0)
+		{
+		  if (n == -1)
+		    {
+		      hfsutil_perrorp(path);
+		      result = -1;
+		    }
+
+		  break;
+		}
+
+	      j = 0;
+	    }
+
+	  ent.dirent = batch[j++];
+
 	  if ((ent.dirent.fdflags & HFS_FNDR_ISINVISIBLE) &&
 	      ! (flags & HLS_ALL_FILES))
 	    continue;
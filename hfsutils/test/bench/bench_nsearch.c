@@ -0,0 +1,187 @@
+/*
+ * libhfs - library for reading and writing Macintosh HFS volumes
+ * Copyright (C) 1996-1998 Robert Leslie
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Microbenchmark: n_search() over a full catalog leaf node, compared with
+ * the former linear scan that unpacked every key before comparing it.
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <time.h>
+
+# include "libhfs.h"
+# include "node.h"
+# include "record.h"
+
+# define NRECS		24
+# define NPROBES	(2 * NRECS + 1)
+# define ROUNDS		200000
+
+/*
+ * NAME:	oldsearch()
+ * DESCRIPTION:	the previous n_search(): linear scan over unpacked keys
+ */
+static
+int oldsearch(node *np, const byte *pkey)
+{
+  CatKeyRec key1, key2;
+  int i, comp = -1;
+
+  r_unpackcatkey(pkey, &key2);
+
+  for (i = np->nd.ndNRecs; i--; )
+    {
+      const byte *rec;
+
+      rec = HFS_NODEREC(*np, i);
+
+      if (HFS_RECKEYLEN(rec) == 0)
+	continue;  /* deleted record */
+
+      r_unpackcatkey(rec, &key1);
+      comp = r_comparecatkeys(&key1, &key2);
+
+      if (comp <= 0)
+	break;
+    }
+
+  np->rnum = i;
+
+  return comp == 0;
+}
+
+/*
+ * NAME:	packkey()
+ * DESCRIPTION:	pack a catalog key for a parent ID and name
+ */
+static
+unsigned int packkey(byte *pkey, unsigned long parid, const char *name)
+{
+  CatKeyRec key;
+  unsigned int len;
+
+  r_makecatkey(&key, parid, name);
+  r_packcatkey(&key, pkey, &len);
+
+  return len;
+}
+
+/*
+ * NAME:	elapsed()
+ * DESCRIPTION:	return seconds of processor time since a given clock value
+ */
+static
+double elapsed(clock_t start)
+{
+  return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(void)
+{
+  btree bt;
+  node n;
+  byte probes[NPROBES][HFS_CATKEYLEN];
+  char name[HFS_MAX_FLEN + 1];
+  unsigned int i, r, offs;
+  unsigned long sum1 = 0, sum2 = 0;
+  clock_t start;
+  double t1, t2;
+
+  memset(&bt, 0, sizeof(bt));
+  bt.keycompare = r_comparecatpkeys;
+
+  memset(&n, 0, sizeof(n));
+  n.bt = &bt;
+  n.nd.ndNRecs = NRECS;
+
+  /* fill a node with ascending keys, one of them deleted */
+
+  for (offs = 0x00e, i = 0; i < NRECS; ++i)
+    {
+      sprintf(name, "File %03u", 2 * i + 1);
+
+      n.roff[i] = offs;
+      offs += packkey(n.data + offs, 16, name);
+    }
+
+  n.roff[NRECS] = offs;
+
+  if (offs > HFS_BLOCKSZ - 2 * (NRECS + 1))
+    {
+      fprintf(stderr, "bench_nsearch: node overflow\n");
+      return 1;
+    }
+
+  HFS_SETKEYLEN(HFS_NODEREC(n, NRECS / 3), 0);
+
+  /* probe every key and every gap, including both ends */
+
+  for (i = 0; i < NPROBES; ++i)
+    {
+      sprintf(name, "file %03u", i);
+      packkey(probes[i], 16, name);
+    }
+
+  for (i = 0; i < NPROBES; ++i)
+    {
+      int f1, f2, r1, r2;
+
+      f1 = oldsearch(&n, probes[i]);
+      r1 = n.rnum;
+
+      f2 = n_search(&n, probes[i]);
+      r2 = n.rnum;
+
+      if (f1 != f2 || r1 != r2)
+	{
+	  fprintf(stderr, "bench_nsearch: probe %u: linear %d/%d, "
+		  "binary %d/%d\n", i, f1, r1, f2, r2);
+	  return 1;
+	}
+    }
+
+  start = clock();
+  for (r = 0; r < ROUNDS; ++r)
+    for (i = 0; i < NPROBES; ++i)
+      sum1 += oldsearch(&n, probes[i]) + n.rnum;
+  t1 = elapsed(start);
+
+  start = clock();
+  for (r = 0; r < ROUNDS; ++r)
+    for (i = 0; i < NPROBES; ++i)
+      sum2 += n_search(&n, probes[i]) + n.rnum;
+  t2 = elapsed(start);
+
+  if (sum1 != sum2)
+    {
+      fprintf(stderr, "bench_nsearch: checksum mismatch\n");
+      return 1;
+    }
+
+  printf("n_search, %u records, %lu searches\n",
+	 NRECS, (unsigned long) ROUNDS * NPROBES);
+  printf("  linear/unpacked  %8.1f ns/search\n",
+	 t1 * 1e9 / ((double) ROUNDS * NPROBES));
+  printf("  binary/packed    %8.1f ns/search  (%.2fx)\n",
+	 t2 * 1e9 / ((double) ROUNDS * NPROBES), t2 > 0 ? t1 / t2 : 0);
+
+  return 0;
+}
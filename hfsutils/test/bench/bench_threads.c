@@ -0,0 +1,513 @@
+/*
+ * libhfs - library for reading and writing Macintosh HFS volumes
+ * Copyright (C) 1996-1998 Robert Leslie
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Microbenchmark: concurrent readers of one read-only volume, both mapped
+ * and through the block cache, each opening its own files or sharing open
+ * files through hfs_pread(). Every thread checks what it reads. Unless
+ * libhfs is built with ENABLE_THREADS, only a single reader is measured.
+ * Finally a worker thread extends every file of a writable mount and calls
+ * hfs_flush() while they are all open.
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <unistd.h>
+# include <signal.h>
+# include <sys/time.h>
+
+# include "libhfs.h"
+
+# define VOLSZ		(8L << 20)
+# define NFILES		24
+# define ROUNDS		8
+# define CACHESZ	(64 * HFS_BLOCKSZ)
+# define CHUNKSZ	(16 * HFS_BLOCKSZ)
+# define EXTRASZ	3000
+# define WATCHDOG	60
+
+# ifdef ENABLE_THREADS
+#  define MAXTHREADS	8
+# else
+#  define MAXTHREADS	1
+# endif
+
+static byte *image;
+static unsigned long imagesz;
+
+static hfsvol *vol;
+static unsigned long sums[NFILES], total;
+
+static hfsfile *shared[NFILES];
+static int nreaders;
+
+/*
+ * NAME:	content()
+ * DESCRIPTION:	return byte i of test file n
+ */
+static
+byte content(int n, unsigned long i)
+{
+  return (byte) ((i * 2654435761UL) >> (n % 24)) ^ n;
+}
+
+/*
+ * NAME:	filesz()
+ * DESCRIPTION:	return the size of test file n
+ */
+static
+unsigned long filesz(int n)
+{
+  return 16384 + n * 9001UL;
+}
+
+/*
+ * NAME:	build()
+ * DESCRIPTION:	create a volume with the test files and load it into memory
+ */
+static
+int build(void)
+{
+  char path[] = "/tmp/bench_threadsXXXXXX", name[32];
+  byte buf[4096];
+  hfsvol *wvol;
+  hfsfile *file;
+  FILE *fp;
+  unsigned long i, j, len;
+  int fd, n;
+
+  fd = mkstemp(path);
+  if (fd == -1 || ftruncate(fd, VOLSZ) == -1)
+    return -1;
+
+  close(fd);
+
+  wvol = 0;
+  if (hfs_format(path, 0, 0, "Bench", 0, 0) == -1 ||
+      (wvol = hfs_mount(path, 0, HFS_MODE_RDWR)) == 0)
+    goto fail;
+
+  for (n = 0; n < NFILES; ++n)
+    {
+      sprintf(name, ":file %02d", n);
+
+      file = hfs_create(wvol, name, "BINA", "BNCH");
+      if (file == 0)
+	goto fail;
+
+      for (i = 0; i < filesz(n); i += len)
+	{
+	  len = filesz(n) - i;
+	  if (len > sizeof(buf))
+	    len = sizeof(buf);
+
+	  for (j = 0; j < len; ++j)
+	    {
+	      buf[j] = content(n, i + j);
+	      sums[n] += buf[j];
+	    }
+
+	  if (hfs_write(file, buf, len) != len)
+	    break;
+	}
+
+      if (hfs_close(file) == -1 || i < filesz(n))
+	goto fail;
+
+      total += filesz(n);
+    }
+
+  if (hfs_umount(wvol) == -1)
+    {
+      wvol = 0;
+      goto fail;
+    }
+
+  fp = fopen(path, "rb");
+  if (fp == 0)
+    goto fail;
+
+  image   = malloc(VOLSZ);
+  imagesz = image ? fread(image, 1, VOLSZ, fp) : 0;
+
+  fclose(fp);
+  unlink(path);
+
+  return imagesz == VOLSZ ? 0 : -1;
+
+fail:
+  if (wvol)
+    hfs_umount(wvol);
+
+  unlink(path);
+
+  return -1;
+}
+
+/*
+ * NAME:	memread()
+ * DESCRIPTION:	read blocks of the image without offering to map it
+ */
+static
+unsigned long memread(void *priv, void *buf, unsigned long len,
+		      unsigned long bnum)
+{
+  unsigned long nblocks = imagesz >> HFS_BLOCKSZ_BITS;
+
+  if (bnum >= nblocks)
+    return 0;
+
+  if (len > nblocks - bnum)
+    len = nblocks - bnum;
+
+  memcpy(buf, image + (bnum << HFS_BLOCKSZ_BITS), len << HFS_BLOCKSZ_BITS);
+
+  return len;
+}
+
+/*
+ * NAME:	memsize()
+ * DESCRIPTION:	return the size of the image in blocks
+ */
+static
+unsigned long memsize(void *priv)
+{
+  return imagesz >> HFS_BLOCKSZ_BITS;
+}
+
+/*
+ * NAME:	reader()
+ * DESCRIPTION:	read every test file, starting at a different one per thread
+ */
+static
+void *reader(void *arg)
+{
+  long id = (long) arg, bad = 0;
+  char name[32];
+  byte buf[7000];
+  int r, i, n;
+
+  for (r = 0; r < ROUNDS; ++r)
+    for (i = 0; i < NFILES; ++i)
+      {
+	hfsfile *file;
+	unsigned long len, size = 0, sum = 0;
+
+	n = (i + id * 5) % NFILES;
+	sprintf(name, "Bench:file %02d", n);
+
+	file = hfs_open(vol, name);
+	if (file == 0)
+	  {
+	    ++bad;
+	    continue;
+	  }
+
+	while ((len = hfs_read(file, buf, sizeof(buf))) > 0 &&
+	       len != (unsigned long) -1)
+	  {
+	    size += len;
+	    while (len--)
+	      sum += buf[len];
+	  }
+
+	hfs_close(file);
+
+	if (size != filesz(n) || sum != sums[n])
+	  ++bad;
+      }
+
+  return (void *) bad;
+}
+
+/*
+ * NAME:	ranger()
+ * DESCRIPTION:	read one thread's share of every shared file with hfs_pread()
+ */
+static
+void *ranger(void *arg)
+{
+  long id = (long) arg, bad = 0;
+  byte buf[CHUNKSZ];
+  unsigned long offset, len, want, j;
+  int r, n;
+
+  for (r = 0; r < ROUNDS; ++r)
+    for (n = 0; n < NFILES; ++n)
+      {
+	for (offset = id * CHUNKSZ; offset < filesz(n);
+	     offset += nreaders * CHUNKSZ)
+	  {
+	    want = filesz(n) - offset;
+	    if (want > CHUNKSZ)
+	      want = CHUNKSZ;
+
+	    len = hfs_pread(shared[n], buf, CHUNKSZ, offset);
+	    if (len != want)
+	      {
+		++bad;
+		continue;
+	      }
+
+	    for (j = 0; j < len; ++j)
+	      {
+		if (buf[j] != content(n, offset + j))
+		  {
+		    ++bad;
+		    break;
+		  }
+	      }
+	  }
+      }
+
+  return (void *) bad;
+}
+
+/*
+ * NAME:	flusher()
+ * DESCRIPTION:	extend every test file, then flush the volume with all open
+ */
+static
+void *flusher(void *arg)
+{
+  hfsfile *files[NFILES];
+  hfsdirent ent;
+  char name[32];
+  byte buf[EXTRASZ];
+  unsigned long j;
+  long bad = 0;
+  int n, nopen;
+
+  for (n = 0; n < NFILES; ++n)
+    {
+      sprintf(name, "Bench:file %02d", n);
+
+      files[n] = hfs_open(vol, name);
+      if (files[n] == 0)
+	break;
+
+      for (j = 0; j < EXTRASZ; ++j)
+	buf[j] = content(n, filesz(n) + j);
+
+      if (hfs_seek(files[n], 0, HFS_SEEK_END) != filesz(n) ||
+	  hfs_write(files[n], buf, EXTRASZ) != EXTRASZ)
+	++bad;
+    }
+
+  nopen = n;
+
+  if (nopen < NFILES || hfs_flush(vol) == -1)
+    ++bad;
+
+  /* the catalog must already hold the new sizes */
+
+  for (n = 0; n < nopen; ++n)
+    {
+      sprintf(name, "Bench:file %02d", n);
+
+      if (hfs_stat(vol, name, &ent) == -1 ||
+	  ent.u.file.dsize != filesz(n) + EXTRASZ)
+	++bad;
+
+      if (hfs_close(files[n]) == -1)
+	++bad;
+    }
+
+  return (void *) bad;
+}
+
+/*
+ * NAME:	run()
+ * DESCRIPTION:	time a number of concurrent workers; return seconds or -1
+ */
+static
+double run(void *(*func)(void *), int nthreads)
+{
+  struct timeval start, end;
+  long bad = 0;
+
+  nreaders = nthreads;
+
+# ifdef ENABLE_THREADS
+  {
+    pthread_t threads[MAXTHREADS];
+    void *result;
+    long i;
+
+    gettimeofday(&start, 0);
+
+    for (i = 0; i < nthreads; ++i)
+      {
+	if (pthread_create(&threads[i], 0, func, (void *) i) != 0)
+	  return -1;
+      }
+
+    for (i = 0; i < nthreads; ++i)
+      {
+	pthread_join(threads[i], &result);
+	bad += (long) result;
+      }
+  }
+# else
+  gettimeofday(&start, 0);
+
+  bad = (long) func(0);
+# endif
+
+  gettimeofday(&end, 0);
+
+  if (bad)
+    return -1;
+
+  return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+}
+
+/*
+ * NAME:	measure()
+ * DESCRIPTION:	report throughput for growing numbers of workers
+ */
+static
+int measure(const char *desc, void *(*func)(void *), int split)
+{
+  unsigned long bytes;
+  double t, t1 = 0;
+  int n;
+
+  if (split)
+    printf("%s, %d open files split among readers by hfs_pread(), %lu KB\n",
+	   desc, NFILES, (total * ROUNDS) >> 10);
+  else
+    printf("%s, %d files, %lu KB per reader\n",
+	   desc, NFILES, (total * ROUNDS) >> 10);
+
+  for (n = 1; n <= MAXTHREADS; n <<= 1)
+    {
+      t = run(func, n);
+      if (t < 0)
+	{
+	  fprintf(stderr, "bench_threads: %s, %d readers: bad data\n",
+		  desc, n);
+	  return -1;
+	}
+
+      if (n == 1)
+	t1 = t;
+
+      bytes = total * ROUNDS * (split ? 1 : n);
+
+      printf("  %d reader%s %10.1f MB/s  (%.2fx)\n", n, n == 1 ? " " : "s",
+	     (double) bytes / (1 << 20) / t,
+	     t > 0 ? t1 * bytes / (total * ROUNDS) / t : 0);
+    }
+
+  return 0;
+}
+
+/*
+ * NAME:	measureall()
+ * DESCRIPTION:	report private and shared file throughput for a volume
+ */
+static
+int measureall(const char *desc)
+{
+  char name[32];
+  int n, result = 0;
+
+  if (measure(desc, reader, 0) == -1)
+    return -1;
+
+  for (n = 0; n < NFILES; ++n)
+    {
+      sprintf(name, "Bench:file %02d", n);
+
+      shared[n] = hfs_open(vol, name);
+      if (shared[n] == 0)
+	return -1;
+    }
+
+  if (measure(desc, ranger, 1) == -1)
+    result = -1;
+
+  /* positional reads must not have moved the files */
+
+  for (n = 0; n < NFILES; ++n)
+    {
+      if (hfs_seek(shared[n], 0, HFS_SEEK_CUR) != 0)
+	{
+	  fprintf(stderr, "bench_threads: %s: file position moved\n", desc);
+	  result = -1;
+	}
+
+      hfs_close(shared[n]);
+    }
+
+  return result;
+}
+
+int main(void)
+{
+  struct hfsioprocs procs;
+
+  if (build() == -1)
+    {
+      fprintf(stderr, "bench_threads: can't build volume: %s\n",
+	      hfs_error ? hfs_error : "unknown error");
+      return 1;
+    }
+
+  vol = hfs_mount_mem(image, imagesz, 0, HFS_MODE_RDONLY);
+  if (vol == 0 || measureall("mapped volume") == -1)
+    return 1;
+
+  hfs_umount(vol);
+
+  memset(&procs, 0, sizeof(procs));
+  procs.read = memread;
+  procs.size = memsize;
+
+  vol = hfs_mount_io(0, &procs, 0, HFS_MODE_RDONLY);
+  if (vol == 0 ||
+      hfs_setcachesz(vol, CACHESZ) == -1 ||
+      measureall("cached volume") == -1)
+    return 1;
+
+  hfs_umount(vol);
+
+  /* a deadlock in hfs_flush() must fail the run rather than hang it */
+
+  alarm(WATCHDOG);
+
+  vol = hfs_mount_mem(image, imagesz, 0, HFS_MODE_RDWR);
+  if (vol == 0 || run(flusher, 1) < 0)
+    {
+      fprintf(stderr, "bench_threads: flush with open files: %s\n",
+	      hfs_error ? hfs_error : "bad data");
+      return 1;
+    }
+
+  if (hfs_umount(vol) == -1)
+    return 1;
+
+  alarm(0);
+
+  printf("flush with %d open files: ok\n", NFILES);
+
+  return 0;
+}
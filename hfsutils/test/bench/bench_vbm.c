@@ -0,0 +1,285 @@
+/*
+ * libhfs - library for reading and writing Macintosh HFS volumes
+ * Copyright (C) 1996-1998 Robert Leslie
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Microbenchmark: v_allocblocks() on fragmented volume bitmaps, compared
+ * with the former search that tested the bitmap one bit at a time. The
+ * free map is rebuilt whenever the bitmap is refragmented.
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <time.h>
+
+# include "libhfs.h"
+# include "volume.h"
+# include "freemap.h"
+
+# define NBLOCKS	65535
+# define NSTARTS	64
+# define ROUNDS		200
+
+/*
+ * NAME:	oldalloc()
+ * DESCRIPTION:	the previous v_allocblocks() search and marking loops
+ */
+static
+unsigned int oldalloc(hfsvol *vol, ExtDescriptor *blocks)
+{
+  unsigned int request, found, foundat, start, end;
+  register unsigned int pt;
+  block *vbm;
+  int wrap = 0;
+
+  request = blocks->xdrNumABlks;
+  found   = 0;
+  foundat = 0;
+  start   = vol->mdb.drAllocPtr;
+  end     = vol->mdb.drNmAlBlks;
+  vbm     = vol->vbm;
+
+  if (! BMTST(vbm, start))
+    {
+      while (start > 0 && ! BMTST(vbm, start - 1))
+	--start;
+    }
+
+  pt = start;
+
+  while (1)
+    {
+      unsigned int mark;
+
+      while (pt < end && BMTST(vbm, pt))
+	++pt;
+
+      if (wrap && pt >= start)
+	break;
+
+      mark = pt;
+      while (pt < end && pt - mark < request && ! BMTST(vbm, pt))
+	++pt;
+
+      if (pt - mark > found)
+	{
+	  found   = pt - mark;
+	  foundat = mark;
+	}
+
+      if (wrap && pt >= start)
+	break;
+
+      if (pt == end)
+	pt = 0, wrap = 1;
+
+      if (found == request)
+	break;
+    }
+
+  blocks->xdrStABN    = foundat;
+  blocks->xdrNumABlks = found;
+
+  vol->mdb.drAllocPtr = pt;
+  vol->mdb.drFreeBks -= found;
+
+  for (pt = foundat; pt < foundat + found; ++pt)
+    BMSET(vbm, pt);
+
+  return pt;
+}
+
+/*
+ * NAME:	oldfree()
+ * DESCRIPTION:	the previous v_freeblocks() marking loop
+ */
+static
+void oldfree(hfsvol *vol, const ExtDescriptor *blocks)
+{
+  unsigned int pt;
+
+  vol->mdb.drFreeBks += blocks->xdrNumABlks;
+
+  for (pt = blocks->xdrStABN;
+       pt < (unsigned int) blocks->xdrStABN + blocks->xdrNumABlks; ++pt)
+    BMCLR(vol->vbm, pt);
+}
+
+/*
+ * NAME:	fragment()
+ * DESCRIPTION:	fill a bitmap, leaving free holes of 1 to maxhole blocks
+ */
+static
+void fragment(hfsvol *vol, unsigned int used, unsigned int maxhole)
+{
+  unsigned int pt, len, nfree = 0;
+
+  memset(vol->vbm, 0xff, vol->vbmsz * HFS_BLOCKSZ);
+
+  for (pt = 0; pt < NBLOCKS; pt += len)
+    {
+      len = 1 + rand() % maxhole;
+
+      if ((unsigned int) rand() % 100 >= used)
+	{
+	  unsigned int i;
+
+	  for (i = pt; i < pt + len && i < NBLOCKS; ++i, ++nfree)
+	    BMCLR(vol->vbm, i);
+	}
+      else
+	len = 1 + rand() % (maxhole * used / (100 - used));
+    }
+
+  vol->mdb.drFreeBks = nfree;
+
+  fm_free(vol);
+}
+
+/*
+ * NAME:	elapsed()
+ * DESCRIPTION:	return seconds of processor time since a given clock value
+ */
+static
+double elapsed(clock_t start)
+{
+  return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+/*
+ * NAME:	run()
+ * DESCRIPTION:	check and time allocations of one size on one bitmap
+ */
+static
+int run(hfsvol *vol, const char *desc, unsigned int request)
+{
+  unsigned int starts[NSTARTS], i, r;
+  ExtDescriptor e1, e2;
+  unsigned long sum1 = 0, sum2 = 0;
+  clock_t start;
+  double t1, t2;
+
+  for (i = 0; i < NSTARTS; ++i)
+    starts[i] = rand() % NBLOCKS;
+
+  for (i = 0; i < NSTARTS; ++i)
+    {
+      unsigned int p1, p2;
+
+      e1.xdrNumABlks = e2.xdrNumABlks = request;
+
+      vol->mdb.drAllocPtr = starts[i];
+      oldalloc(vol, &e1);
+      p1 = vol->mdb.drAllocPtr;
+      oldfree(vol, &e1);
+
+      vol->mdb.drAllocPtr = starts[i];
+      if (v_allocblocks(vol, &e2) == -1)
+	{
+	  fprintf(stderr, "bench_vbm: %s\n", hfs_error);
+	  return -1;
+	}
+      p2 = vol->mdb.drAllocPtr;
+      v_freeblocks(vol, &e2);
+
+      /* the allocation pointer now always follows the blocks allocated */
+
+      if (e1.xdrStABN != e2.xdrStABN || e1.xdrNumABlks != e2.xdrNumABlks ||
+	  (e1.xdrNumABlks == request && p1 != p2))
+	{
+	  fprintf(stderr, "bench_vbm: %s, start %u: bitwise %u+%u, "
+		  "indexed %u+%u\n", desc, starts[i],
+		  e1.xdrStABN, e1.xdrNumABlks, e2.xdrStABN, e2.xdrNumABlks);
+	  return -1;
+	}
+    }
+
+  start = clock();
+  for (r = 0; r < ROUNDS; ++r)
+    for (i = 0; i < NSTARTS; ++i)
+      {
+	e1.xdrNumABlks = request;
+	vol->mdb.drAllocPtr = starts[i];
+	oldalloc(vol, &e1);
+	oldfree(vol, &e1);
+	sum1 += e1.xdrStABN;
+      }
+  t1 = elapsed(start);
+
+  start = clock();
+  for (r = 0; r < ROUNDS; ++r)
+    for (i = 0; i < NSTARTS; ++i)
+      {
+	e2.xdrNumABlks = request;
+	vol->mdb.drAllocPtr = starts[i];
+	v_allocblocks(vol, &e2);
+	v_freeblocks(vol, &e2);
+	sum2 += e2.xdrStABN;
+      }
+  t2 = elapsed(start);
+
+  if (sum1 != sum2)
+    {
+      fprintf(stderr, "bench_vbm: checksum mismatch\n");
+      return -1;
+    }
+
+  printf("%s, %u-block requests\n", desc, request);
+  printf("  bitwise   %10.1f ns/allocation\n",
+	 t1 * 1e9 / ((double) ROUNDS * NSTARTS));
+  printf("  indexed   %10.1f ns/allocation  (%.2fx)\n",
+	 t2 * 1e9 / ((double) ROUNDS * NSTARTS), t2 > 0 ? t1 / t2 : 0);
+
+  return 0;
+}
+
+int main(void)
+{
+  hfsvol vol;
+
+  memset(&vol, 0, sizeof(vol));
+
+  vol.mdb.drNmAlBlks = NBLOCKS;
+  vol.vbmsz = (NBLOCKS + HFS_BLOCKSZ * 8 - 1) / (HFS_BLOCKSZ * 8);
+  vol.vbm   = ALLOC(block, vol.vbmsz);
+  if (vol.vbm == 0)
+    {
+      fprintf(stderr, "bench_vbm: not enough memory\n");
+      return 1;
+    }
+
+  srand(1998);
+
+  fragment(&vol, 50, 16);
+  if (run(&vol, "50% used, holes of 1-16 blocks", 8) == -1)
+    return 1;
+
+  fragment(&vol, 97, 4);
+  if (run(&vol, "97% used, holes of 1-4 blocks", 8) == -1)
+    return 1;
+
+  fragment(&vol, 99, 2);
+  if (run(&vol, "99% used, holes of 1-2 blocks", 64) == -1)
+    return 1;
+
+  fm_free(&vol);
+  free(vol.vbm);
+
+  return 0;
+}
@@ -9,8 +9,12 @@ cd "$(dirname "$0")/.."
 
 HFSUTIL="./hfsutil"
 TMP="/tmp/test_hfsutils_$$"
+SOCK="$TMP/hfsutild.sock"
 mkdir -p "$TMP"
-trap "rm -rf $TMP" EXIT
+trap "[ -S $SOCK ] && HFSUTILD_SOCKET=$SOCK $HFSUTIL daemon -q; rm -rf $TMP" EXIT
+
+# run commands here, not in any hfsutild the user may have started
+export HFSUTILD_SOCKET=
 
 echo "========================================="
 echo "  hfsutil Commands Test Suite"
@@ -71,9 +75,123 @@ echo "+ HFS operations complete"
 echo ""
 
 #
-# TEST 2: HFS+ Volume Operations
+# TEST 2: Batch Mode
+#
+echo "=== Test 2: Batch Mode ==="
+echo "[1] Run commands from a batch file..."
+cat > "$TMP/batch.txt" <<EOF
+# build a small tree on one mounted volume
+hformat -l "TestBatch" "$IMG"
+hmkdir "Batch Dir"
+hcopy "$TMP/testfile.txt" ":Batch Dir:first file"
+sync
+hcopy "$TMP/testfile.txt" :Batch\\ Dir:second
+hrename ":Batch Dir:second" ":Batch Dir:renamed"
+hls ":Batch Dir"
+EOF
+$HFSUTIL batch "$TMP/batch.txt" > "$TMP/batch.out" 2>&1 || { echo "FAIL: batch"; cat "$TMP/batch.out"; exit 1; }
+grep -q "first file" "$TMP/batch.out" && grep -q renamed "$TMP/batch.out" || { echo "FAIL: batch output"; exit 1; }
+echo "  + batch ran all commands"
+
+echo "[2] Verify results after the batch..."
+$HFSUTIL hcopy ":Batch Dir:renamed" "$TMP/batch_retrieved.txt" >/dev/null 2>&1 || { echo "FAIL: hcopy after batch"; exit 1; }
+diff "$TMP/testfile.txt" "$TMP/batch_retrieved.txt" >/dev/null 2>&1 || { echo "FAIL: batch content"; exit 1; }
+echo "  + Changes written when batch ended"
+
+echo "[3] Report failing commands..."
+printf 'hls :nonexistent\nbogus\n' | $HFSUTIL batch >/dev/null 2>&1 && { echo "FAIL: batch status"; exit 1; }
+echo "  + Nonzero status on failure"
+
+$HFSUTIL humount >/dev/null 2>&1 || { echo "FAIL: humount"; exit 1; }
+
+echo "+ Batch mode complete"
+echo ""
+
+#
+# TEST 3: Daemon
+#
+echo "=== Test 3: Daemon ==="
+echo "[1] Start hfsutild..."
+export HFSUTILD_SOCKET="$SOCK"
+$HFSUTIL daemon || { echo "FAIL: daemon start"; exit 1; }
+[ -S "$SOCK" ] || { echo "FAIL: daemon socket"; exit 1; }
+echo "  + Listening on $SOCK"
+
+echo "[2] Run commands through the daemon..."
+$HFSUTIL hmount "$IMG" >/dev/null 2>&1 || { echo "FAIL: hmount via daemon"; exit 1; }
+$HFSUTIL hcopy "$TMP/testfile.txt" ":Batch Dir:daemon" >/dev/null 2>&1 || { echo "FAIL: hcopy via daemon"; exit 1; }
+echo "via stdin" | $HFSUTIL hcopy - ":Batch Dir:piped" >/dev/null 2>&1 || { echo "FAIL: hcopy stdin via daemon"; exit 1; }
+$HFSUTIL hls ":Batch Dir" 2>/dev/null | grep -q daemon || { echo "FAIL: hls via daemon"; exit 1; }
+$HFSUTIL hdel ":Batch Dir:nonexistent" >/dev/null 2>&1 && { echo "FAIL: daemon status"; exit 1; }
+echo "  + Output and exit status returned to the caller"
+
+echo "[3] Survive a client that never sends..."
+if command -v perl >/dev/null 2>&1; then
+    perl -MIO::Socket::UNIX -e '$s = IO::Socket::UNIX->new(Peer => $ARGV[0]) or exit 1; sleep 60' "$SOCK" &
+    STALL=$!
+    sleep 1
+    WEDGED=0
+    timeout -s KILL 20 $HFSUTIL hls ":Batch Dir" > "$TMP/stall.txt" 2>/dev/null || WEDGED=1
+    grep -q daemon "$TMP/stall.txt" || WEDGED=1
+    kill $STALL 2>/dev/null || true
+    wait $STALL 2>/dev/null || true
+    [ $WEDGED = 0 ] || { echo "FAIL: daemon wedged by idle client"; exit 1; }
+    echo "  + Stalled client dropped"
+else
+    echo "  - perl not found, skipped"
+fi
+
+echo "[4] Stop hfsutild..."
+$HFSUTIL daemon -q || { echo "FAIL: daemon stop"; exit 1; }
+[ -S "$SOCK" ] && { echo "FAIL: socket left behind"; exit 1; }
+export HFSUTILD_SOCKET=
+$HFSUTIL hcopy ":Batch Dir:piped" "$TMP/piped.txt" >/dev/null 2>&1 || { echo "FAIL: hcopy after daemon"; exit 1; }
+[ "$(cat "$TMP/piped.txt")" = "via stdin" ] || { echo "FAIL: daemon content"; exit 1; }
+echo "  + Changes on disk after the daemon exits"
+
+$HFSUTIL humount >/dev/null 2>&1 || { echo "FAIL: humount"; exit 1; }
+
+echo "+ Daemon complete"
+echo ""
+
+#
+# TEST 4: Volume Bitmap
+#
+echo "=== Test 4: Volume Bitmap ==="
+echo "[1] Free blocks recorded in distant parts of the bitmap..."
+# 512-byte allocation blocks; the filler's bits fill bitmap blocks 1 and 2,
+# which are volume blocks 4 and 5 (the bitmap always starts at block 3)
+BIG="$TMP/big.img"
+dd if=/dev/zero of="$BIG" bs=1M count=30 2>/dev/null
+head -c 10240 /dev/urandom > "$TMP/small.bin"
+head -c 6291456 /dev/urandom > "$TMP/filler.bin"
+cat > "$TMP/vbm.txt" <<EOF
+hformat -l "TestVBM" "$BIG"
+hcopy -r "$TMP/small.bin" :a
+hcopy -r "$TMP/filler.bin" :filler
+hcopy -r "$TMP/small.bin" :b
+EOF
+$HFSUTIL batch "$TMP/vbm.txt" >/dev/null 2>&1 || { echo "FAIL: bitmap setup"; exit 1; }
+dd if="$BIG" of="$TMP/vbm_before" bs=512 skip=4 count=2 2>/dev/null
+printf 'hdel :a\nhdel :b\n' | $HFSUTIL batch >/dev/null 2>&1 || { echo "FAIL: hdel"; exit 1; }
+echo "  + Deleted two files in one session"
+
+echo "[2] Verify bitmap blocks between them..."
+dd if="$BIG" of="$TMP/vbm_after" bs=512 skip=4 count=2 2>/dev/null
+cmp -s "$TMP/vbm_before" "$TMP/vbm_after" || { echo "FAIL: unread bitmap blocks overwritten"; exit 1; }
+$HFSUTIL hcopy -r :filler "$TMP/filler_out.bin" >/dev/null 2>&1 || { echo "FAIL: hcopy out"; exit 1; }
+cmp -s "$TMP/filler.bin" "$TMP/filler_out.bin" || { echo "FAIL: filler content"; exit 1; }
+echo "  + Unread bitmap blocks left intact"
+
+$HFSUTIL humount >/dev/null 2>&1 || { echo "FAIL: humount"; exit 1; }
+
+echo "+ Volume bitmap complete"
+echo ""
+
+#
+# TEST 5: HFS+ Volume Operations
 #
-echo "=== Test 2: HFS+ Volume Operations ==="
+echo "=== Test 5: HFS+ Volume Operations ==="
 echo "[1] Format as HFS+..."
 $HFSUTIL hformat -t hfs+ -l "TestHFSPlus" "$IMG" >/dev/null 2>&1 || { echo "FAIL: hformat -t hfs+"; exit 1; }
 echo "  + hformat created HFS+ volume"
@@ -104,9 +222,9 @@ echo "+ HFS+ operations complete"
 echo ""
 
 #
-# TEST 3: Version Info
+# TEST 6: Version Info
 #
-echo "=== Test 3: Version Info ==="
+echo "=== Test 6: Version Info ==="
 $HFSUTIL --version >/dev/null 2>&1 || { echo "FAIL: version"; exit 1; }
 echo "+ Version info available"
 echo ""
@@ -119,4 +237,7 @@ echo "  - Directory creation (mkdir)"
 echo "  - File listing (ls)"
 echo "  - File copy in/out (hcopy)"
 echo "  - Content integrity verified"
+echo "  - Batch mode (hfsutil batch)"
+echo "  - Daemon (hfsutild)"
+echo "  - Volume bitmap write-back"
 echo "========================================="